@@ -10,6 +10,8 @@
 #define FLXLIBS_INCLUDE_FLXLIBS_AVAILABLEPARSEROPERATIONS_HPP_
 
 #include "FelixIssues.hpp"
+#include "flxlibs/DmaLeaseTable.hpp"
+#include "flxlibs/LeasedChunk.hpp"
 
 #include "iomanager/Sender.hpp"
 #include "fdreadoutlibs/FDReadoutTypes.hpp"
@@ -17,7 +19,10 @@
 #include "packetformat/block_format.hpp"
 
 #include <algorithm>
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <memory>
 #include <sstream>
 #include <utility>
@@ -59,12 +64,40 @@ dump_to_buffer(const char* data,
   }
 }
 
+/**
+ * Parser policies: the handlers below as types, for the compile-time parser
+ * PolicyParserImpl. Each policy holds its sink and is called per event without a
+ * std::function. Chunk handlers take any type with the accessors of
+ * felix::packetformat::chunk, e.g. the chunks of the native block decoder. The
+ * std::function factories further down wrap the same handlers for the
+ * runtime-rebindable DefaultParserImpl.
+ */
+
+// Ignores the event, the call compiles away
+struct Discard
+{
+  template<class Event>
+  void operator()(const Event& /*event*/) const
+  {}
+};
+
 template<class TargetStruct>
-inline std::function<void(const felix::packetformat::chunk& chunk)>
-fixsizedChunkInto(std::shared_ptr<iomanager::SenderConcept<TargetStruct>>& sink,
-                  std::chrono::milliseconds timeout = std::chrono::milliseconds(100))
+struct FixsizedChunkInto
 {
-  return [&](const felix::packetformat::chunk& chunk) {
+  std::shared_ptr<iomanager::SenderConcept<TargetStruct>> sink;
+  std::chrono::milliseconds timeout{ 100 };
+
+  template<class Chunk>
+  void operator()(const Chunk& chunk) const
+  {
+    process(*sink, chunk, timeout);
+  }
+
+  template<class Chunk>
+  static void process(iomanager::SenderConcept<TargetStruct>& sink,
+                      const Chunk& chunk,
+                      std::chrono::milliseconds timeout)
+  {
     // Chunk info
     auto subchunk_data = chunk.subchunks();
     auto subchunk_sizes = chunk.subchunk_lengths();
@@ -84,11 +117,21 @@ fixsizedChunkInto(std::shared_ptr<iomanager::SenderConcept<TargetStruct>>& sink,
       }
       try {
         // finally, push to sink
-        sink->send(std::move(payload), timeout);
+        sink.send(std::move(payload), timeout);
       } catch (const dunedaq::iomanager::TimeoutExpired& excpt) {
         // ers::error(ParserOperationQueuePushFailure(ERS_HERE, " "));
       }
     }
+  }
+};
+
+template<class TargetStruct>
+inline std::function<void(const felix::packetformat::chunk& chunk)>
+fixsizedChunkInto(std::shared_ptr<iomanager::SenderConcept<TargetStruct>>& sink,
+                  std::chrono::milliseconds timeout = std::chrono::milliseconds(100))
+{
+  return [&sink, timeout](const felix::packetformat::chunk& chunk) {
+    FixsizedChunkInto<TargetStruct>::process(*sink, chunk, timeout);
   };
 }
 
@@ -157,11 +200,22 @@ fixsizedChunkViaHeap(std::shared_ptr<iomanager::SenderConcept<TargetStruct*>>& s
 }
 
 template<class TargetWithDatafield>
-inline std::function<void(const felix::packetformat::chunk&)>
-varsizedChunkIntoWithDatafield(std::shared_ptr<iomanager::SenderConcept<TargetWithDatafield>>& sink,
-                               std::chrono::milliseconds timeout = std::chrono::milliseconds(100))
+struct VarsizedChunkIntoWithDatafield
 {
-  return [&](const felix::packetformat::chunk& chunk) {
+  std::shared_ptr<iomanager::SenderConcept<TargetWithDatafield>> sink;
+  std::chrono::milliseconds timeout{ 100 };
+
+  template<class Chunk>
+  void operator()(const Chunk& chunk) const
+  {
+    process(*sink, chunk, timeout);
+  }
+
+  template<class Chunk>
+  static void process(iomanager::SenderConcept<TargetWithDatafield>& sink,
+                      const Chunk& chunk,
+                      std::chrono::milliseconds timeout)
+  {
     auto subchunk_data = chunk.subchunks();
     auto subchunk_sizes = chunk.subchunk_lengths();
     auto n_subchunks = chunk.subchunk_number();
@@ -178,18 +232,39 @@ varsizedChunkIntoWithDatafield(std::shared_ptr<iomanager::SenderConcept<TargetWi
     }
     twd.set_data_size(bytes_copied_chunk);
     try {
-      sink->send(std::move(twd), timeout);
+      sink.send(std::move(twd), timeout);
     } catch (const dunedaq::iomanager::TimeoutExpired& excpt) {
       // ers::error
     }
+  }
+};
+
+template<class TargetWithDatafield>
+inline std::function<void(const felix::packetformat::chunk&)>
+varsizedChunkIntoWithDatafield(std::shared_ptr<iomanager::SenderConcept<TargetWithDatafield>>& sink,
+                               std::chrono::milliseconds timeout = std::chrono::milliseconds(100))
+{
+  return [&sink, timeout](const felix::packetformat::chunk& chunk) {
+    VarsizedChunkIntoWithDatafield<TargetWithDatafield>::process(*sink, chunk, timeout);
   };
 }
 
-inline std::function<void(const felix::packetformat::chunk& chunk)>
-varsizedChunkIntoWrapper(std::shared_ptr<iomanager::SenderConcept<fdreadoutlibs::types::VariableSizePayloadWrapper>>& sink,
-                         std::chrono::milliseconds timeout = std::chrono::milliseconds(100))
+struct VarsizedChunkIntoWrapper
 {
-  return [&](const felix::packetformat::chunk& chunk) {
+  std::shared_ptr<iomanager::SenderConcept<fdreadoutlibs::types::VariableSizePayloadWrapper>> sink;
+  std::chrono::milliseconds timeout{ 100 };
+
+  template<class Chunk>
+  void operator()(const Chunk& chunk) const
+  {
+    process(*sink, chunk, timeout);
+  }
+
+  template<class Chunk>
+  static void process(iomanager::SenderConcept<fdreadoutlibs::types::VariableSizePayloadWrapper>& sink,
+                      const Chunk& chunk,
+                      std::chrono::milliseconds timeout)
+  {
     auto subchunk_data = chunk.subchunks();
     auto subchunk_sizes = chunk.subchunk_lengths();
     auto n_subchunks = chunk.subchunk_number();
@@ -204,45 +279,173 @@ varsizedChunkIntoWrapper(std::shared_ptr<iomanager::SenderConcept<fdreadoutlibs:
     }
     fdreadoutlibs::types::VariableSizePayloadWrapper payload_wrapper(chunk_length, payload);
     try {
-      sink->send(std::move(payload_wrapper), timeout);
+      sink.send(std::move(payload_wrapper), timeout);
     } catch (const dunedaq::iomanager::TimeoutExpired& excpt) {
       // ers
     }
+  }
+};
+
+inline std::function<void(const felix::packetformat::chunk& chunk)>
+varsizedChunkIntoWrapper(std::shared_ptr<iomanager::SenderConcept<fdreadoutlibs::types::VariableSizePayloadWrapper>>& sink,
+                         std::chrono::milliseconds timeout = std::chrono::milliseconds(100))
+{
+  return [&sink, timeout](const felix::packetformat::chunk& chunk) {
+    VarsizedChunkIntoWrapper::process(*sink, chunk, timeout);
   };
 }
 
-inline std::function<void(const felix::packetformat::shortchunk& shortchunk)>
-varsizedShortchunkIntoWrapper(std::shared_ptr<iomanager::SenderConcept<fdreadoutlibs::types::VariableSizePayloadWrapper>>& sink,
-                              std::chrono::milliseconds timeout = std::chrono::milliseconds(100))
+struct VarsizedShortchunkIntoWrapper
 {
-  return [&](const felix::packetformat::shortchunk& shortchunk) {
+  std::shared_ptr<iomanager::SenderConcept<fdreadoutlibs::types::VariableSizePayloadWrapper>> sink;
+  std::chrono::milliseconds timeout{ 100 };
+
+  void operator()(const felix::packetformat::shortchunk& shortchunk) const { process(*sink, shortchunk, timeout); }
+
+  static void process(iomanager::SenderConcept<fdreadoutlibs::types::VariableSizePayloadWrapper>& sink,
+                      const felix::packetformat::shortchunk& shortchunk,
+                      std::chrono::milliseconds timeout)
+  {
     auto shortchunk_length = shortchunk.length;
     char* payload = static_cast<char*>(malloc(shortchunk_length * sizeof(char)));
     std::memcpy(payload, shortchunk.data, shortchunk_length);
     fdreadoutlibs::types::VariableSizePayloadWrapper payload_wrapper(shortchunk_length, payload);
     try {
-      sink->send(std::move(payload_wrapper), timeout);
+      sink.send(std::move(payload_wrapper), timeout);
     } catch (const dunedaq::iomanager::TimeoutExpired& excpt) {
       // ers
     }
+  }
+};
+
+inline std::function<void(const felix::packetformat::shortchunk& shortchunk)>
+varsizedShortchunkIntoWrapper(std::shared_ptr<iomanager::SenderConcept<fdreadoutlibs::types::VariableSizePayloadWrapper>>& sink,
+                              std::chrono::milliseconds timeout = std::chrono::milliseconds(100))
+{
+  return [&sink, timeout](const felix::packetformat::shortchunk& shortchunk) {
+    VarsizedShortchunkIntoWrapper::process(*sink, shortchunk, timeout);
   };
 }
 
 
+// Without a sink, errored chunks are only counted
+struct ErrorChunkIntoSink
+{
+  std::shared_ptr<iomanager::SenderConcept<felix::packetformat::chunk>> sink;
+  std::chrono::milliseconds timeout{ 100 };
+
+  void operator()(const felix::packetformat::chunk& chunk) const
+  {
+    if (sink != nullptr) {
+      process(*sink, chunk, timeout);
+    }
+  }
+
+  // Chunks of the native block decoder reference the DMA buffer, they are only counted
+  template<class Chunk>
+  void operator()(const Chunk& /*chunk*/) const
+  {}
+
+  static void process(iomanager::SenderConcept<felix::packetformat::chunk>& sink,
+                      const felix::packetformat::chunk& chunk,
+                      std::chrono::milliseconds timeout)
+  {
+    try {
+      auto payload = chunk;
+      sink.send(std::move(payload), timeout);
+    } catch (const dunedaq::iomanager::TimeoutExpired& excpt) {
+      // ers
+    }
+  }
+};
+
 inline std::function<void(const felix::packetformat::chunk& chunk)>
 errorChunkIntoSink(std::shared_ptr<iomanager::SenderConcept<felix::packetformat::chunk>>& sink,
                    std::chrono::milliseconds timeout = std::chrono::milliseconds(100))
 {
-  return [&](const felix::packetformat::chunk& chunk) {
+  return [&sink, timeout](const felix::packetformat::chunk& chunk) { ErrorChunkIntoSink::process(*sink, chunk, timeout); };
+}
+
+
+// Leases the contiguous chunk at data if it lies in a DMA buffer with a lease table,
+// otherwise copies it
+inline LeasedChunk
+lease_or_copy(const char* data, std::size_t size)
+{
+  LeasedChunk leased_chunk;
+  leased_chunk.size = size;
+  if (auto* table = DmaLeaseTable::find(data)) {
+    leased_chunk.data = table->lease(data);
+    leased_chunk.leased = true;
+  } else {
+    std::shared_ptr<char> copy(new char[size], std::default_delete<char[]>());
+    std::memcpy(copy.get(), data, size);
+    leased_chunk.data = std::move(copy);
+  }
+  return leased_chunk;
+}
+
+// Zero-copy delivery: chunks in a single subchunk are leased from the DMA buffer, chunks
+// over several subchunks, and so over block boundaries, are copied
+struct LeasedChunkInto
+{
+  std::shared_ptr<iomanager::SenderConcept<LeasedChunk>> sink;
+  std::chrono::milliseconds timeout{ 100 };
+
+  template<class Chunk>
+  void operator()(const Chunk& chunk) const
+  {
+    process(*sink, chunk, timeout);
+  }
+
+  template<class Chunk>
+  static void process(iomanager::SenderConcept<LeasedChunk>& sink, const Chunk& chunk, std::chrono::milliseconds timeout)
+  {
+    auto subchunk_data = chunk.subchunks();
+    auto subchunk_sizes = chunk.subchunk_lengths();
+    auto n_subchunks = chunk.subchunk_number();
+    auto chunk_length = chunk.length();
+
+    LeasedChunk leased_chunk;
+    if (n_subchunks == 1) {
+      leased_chunk = lease_or_copy(subchunk_data[0], chunk_length);
+    } else {
+      std::shared_ptr<char> copy(new char[chunk_length], std::default_delete<char[]>());
+      uint32_t bytes_copied_chunk = 0; // NOLINT(build/unsigned)
+      for (unsigned i = 0; i < n_subchunks; ++i) {
+        dump_to_buffer(
+          subchunk_data[i], subchunk_sizes[i], static_cast<void*>(copy.get()), bytes_copied_chunk, chunk_length);
+        bytes_copied_chunk += subchunk_sizes[i];
+      }
+      leased_chunk.data = std::move(copy);
+      leased_chunk.size = chunk_length;
+    }
     try {
-      auto payload = chunk;
-      sink->send(std::move(payload), timeout);
+      sink.send(std::move(leased_chunk), timeout);
     } catch (const dunedaq::iomanager::TimeoutExpired& excpt) {
       // ers
     }
-  };
-}
+  }
+};
+
+struct LeasedShortchunkInto
+{
+  std::shared_ptr<iomanager::SenderConcept<LeasedChunk>> sink;
+  std::chrono::milliseconds timeout{ 100 };
 
+  void operator()(const felix::packetformat::shortchunk& shortchunk) const { process(*sink, shortchunk, timeout); }
+
+  static void process(iomanager::SenderConcept<LeasedChunk>& sink,
+                      const felix::packetformat::shortchunk& shortchunk,
+                      std::chrono::milliseconds timeout)
+  {
+    try {
+      sink.send(lease_or_copy(shortchunk.data, shortchunk.length), timeout);
+    } catch (const dunedaq::iomanager::TimeoutExpired& excpt) {
+      // ers
+    }
+  }
+};
 
 //// Implement here any other DUNE specific FELIX chunk/block to User payload parsers
 
@@ -0,0 +1,208 @@
+/**
+ * @file DmaLeaseTable.hpp Holds on the blocks of a DMA buffer, that keep the card from
+ * overwriting blocks still being parsed or referenced downstream
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef FLXLIBS_INCLUDE_FLXLIBS_DMALEASETABLE_HPP_
+#define FLXLIBS_INCLUDE_FLXLIBS_DMALEASETABLE_HPP_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace dunedaq::flxlibs {
+
+/**
+ * @brief Hold counts per segment of 16 blocks of a DMA buffer.
+ *
+ * The router holds every block it hands out, the consumer of the block releases it once
+ * parsed or dropped. While it parses, the consumer may lease the block for a chunk handed
+ * downstream without a copy; the lease is released when the last reference to the chunk
+ * goes away. The DMA thread moves the card's read pointer up to the first held segment
+ * only, so the card never overwrites a held block. A block is leased only while its
+ * router hold is still in place, which is why no lease can appear behind the read pointer.
+ * Once the card filled the buffer up to a held block no data arrives, so the DMA thread
+ * arms a wakeup that the release freeing the next segment calls.
+ *
+ * Tables register themselves, so chunk handlers find the table of a block by its address.
+ */
+class DmaLeaseTable
+{
+public:
+  static constexpr size_t s_segment_blocks = 16;
+  static constexpr size_t s_max_tables = 32;
+
+  DmaLeaseTable(uint64_t virt_addr, size_t buffer_size, size_t block_size) // NOLINT(build/unsigned)
+    : m_begin(virt_addr)
+    , m_end(virt_addr + buffer_size)
+    , m_block_size(block_size)
+    , m_num_blocks(buffer_size / block_size)
+    , m_segments((m_num_blocks + s_segment_blocks - 1) / s_segment_blocks)
+  {
+    for (auto& slot : s_tables) {
+      DmaLeaseTable* expected = nullptr;
+      if (slot.compare_exchange_strong(expected, this)) {
+        break;
+      }
+    }
+  }
+
+  // Once outstanding() is 0, a lease may still be in its release: wait for it to leave the table
+  ~DmaLeaseTable()
+  {
+    deregister();
+    while (m_releasing_leases.load() != 0) {
+      std::this_thread::yield();
+    }
+  }
+
+  DmaLeaseTable(const DmaLeaseTable&) = delete;            ///< DmaLeaseTable is not copy-constructible
+  DmaLeaseTable& operator=(const DmaLeaseTable&) = delete; ///< DmaLeaseTable is not copy-assignable
+  DmaLeaseTable(DmaLeaseTable&&) = delete;                 ///< DmaLeaseTable is not move-constructible
+  DmaLeaseTable& operator=(DmaLeaseTable&&) = delete;      ///< DmaLeaseTable is not move-assignable
+
+  // Table of the DMA buffer that contains addr, or nullptr
+  static DmaLeaseTable* find(const void* addr)
+  {
+    auto address = reinterpret_cast<uint64_t>(addr); // NOLINT
+    for (auto& slot : s_tables) {
+      DmaLeaseTable* table = slot.load(std::memory_order_acquire);
+      if (table != nullptr && table->m_begin <= address && address < table->m_end) {
+        return table;
+      }
+    }
+    return nullptr;
+  }
+
+  // No new leases through find(), and no more wakeups. Outstanding leases stay valid while
+  // the table lives.
+  void deregister()
+  {
+    for (auto& slot : s_tables) {
+      DmaLeaseTable* expected = this;
+      slot.compare_exchange_strong(expected, nullptr);
+    }
+    set_wakeup(nullptr);
+  }
+
+  // Called by the thread whose release frees a segment while the wakeup is armed
+  void set_wakeup(std::function<void()> wakeup)
+  {
+    std::lock_guard<std::mutex> lock(m_wakeup_mutex);
+    m_wakeup = std::move(wakeup);
+  }
+
+  // DMA thread, with the read pointer held back: call the wakeup on the next freed segment.
+  // Arm before the hold_back() that may find the segments held, so no release is missed.
+  void arm_wakeup() { m_wakeup_armed.store(true); }
+
+  // Router: holds the blocks of a contiguous span, one update per segment
+  void hold_span(uint64_t first_block_addr, size_t count) // NOLINT(build/unsigned)
+  {
+    size_t block = (first_block_addr - m_begin) / m_block_size;
+    while (count != 0) {
+      size_t in_segment = std::min(count, s_segment_blocks - block % s_segment_blocks);
+      m_segments[block / s_segment_blocks].holds.fetch_add(in_segment, std::memory_order_relaxed);
+      block += in_segment;
+      count -= in_segment;
+    }
+  }
+
+  // Consumer of a block, after its last access to the block
+  void release(uint64_t block_addr) // NOLINT(build/unsigned)
+  {
+    drop(segment_of(block_addr));
+  }
+
+  // Leases the block of data, which the caller holds. The returned pointer releases the
+  // lease when its last copy is destroyed.
+  std::shared_ptr<const char> lease(const char* data)
+  {
+    auto& segment = segment_of(reinterpret_cast<uint64_t>(data)); // NOLINT
+    segment.holds.fetch_add(1, std::memory_order_relaxed);
+    return std::shared_ptr<const char>(data, [this, &segment](const char*) {
+      m_releasing_leases.fetch_add(1);
+      drop(segment);
+      m_releasing_leases.fetch_sub(1);
+    });
+  }
+
+  // DMA thread: how far the read pointer may move from block index from towards block
+  // index to, in ring order. Stops at the first held segment, or in it if from is in it.
+  size_t hold_back(size_t from, size_t to) const
+  {
+    size_t remaining = (to + m_num_blocks - from) % m_num_blocks;
+    size_t block = from;
+    while (remaining != 0) {
+      if (m_segments[block / s_segment_blocks].holds.load() != 0) {
+        return block;
+      }
+      size_t step = std::min(remaining, s_segment_blocks - block % s_segment_blocks);
+      block = (block + step) % m_num_blocks;
+      remaining -= step;
+    }
+    return block;
+  }
+
+  // Holds and leases outstanding in the whole buffer
+  size_t outstanding() const
+  {
+    size_t holds = 0;
+    for (const auto& segment : m_segments) {
+      holds += segment.holds.load(std::memory_order_acquire);
+    }
+    return holds;
+  }
+
+  size_t num_blocks() const { return m_num_blocks; }
+
+private:
+  struct alignas(64) Segment
+  {
+    std::atomic<uint32_t> holds{ 0 }; // NOLINT(build/unsigned)
+  };
+
+  Segment& segment_of(uint64_t addr) // NOLINT(build/unsigned)
+  {
+    return m_segments[(addr - m_begin) / m_block_size / s_segment_blocks];
+  }
+
+  // Sequentially consistent with arm_wakeup() and hold_back(): either the DMA thread sees
+  // the segment free, or this sees the wakeup armed
+  void drop(Segment& segment)
+  {
+    if (segment.holds.fetch_sub(1) == 1 && m_wakeup_armed.load() && m_wakeup_armed.exchange(false)) {
+      std::lock_guard<std::mutex> lock(m_wakeup_mutex);
+      if (m_wakeup) {
+        m_wakeup();
+      }
+    }
+  }
+
+  uint64_t m_begin; // NOLINT(build/unsigned)
+  uint64_t m_end;   // NOLINT(build/unsigned)
+  size_t m_block_size;
+  size_t m_num_blocks;
+  std::vector<Segment> m_segments;
+  std::atomic<bool> m_wakeup_armed{ false };
+  std::mutex m_wakeup_mutex;
+  std::function<void()> m_wakeup;
+  std::atomic<int> m_releasing_leases{ 0 };
+
+  inline static std::array<std::atomic<DmaLeaseTable*>, s_max_tables> s_tables{};
+};
+
+} // namespace dunedaq::flxlibs
+
+#endif // FLXLIBS_INCLUDE_FLXLIBS_DMALEASETABLE_HPP_
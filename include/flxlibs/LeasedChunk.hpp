@@ -0,0 +1,30 @@
+/**
+ * @file LeasedChunk.hpp Chunk handed downstream without a copy out of the DMA buffer
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef FLXLIBS_INCLUDE_FLXLIBS_LEASEDCHUNK_HPP_
+#define FLXLIBS_INCLUDE_FLXLIBS_LEASEDCHUNK_HPP_
+
+#include <cstddef>
+#include <memory>
+
+namespace dunedaq::flxlibs {
+
+/**
+ * @brief A chunk of an elink. If leased, data points into the DMA buffer and the card
+ * doesn't overwrite the block while any copy of data is alive, so consumers should drop
+ * it soon. Otherwise data owns a copy of the chunk.
+ */
+struct LeasedChunk
+{
+  std::shared_ptr<const char> data;
+  std::size_t size{ 0 };
+  bool leased{ false };
+};
+
+} // namespace dunedaq::flxlibs
+
+#endif // FLXLIBS_INCLUDE_FLXLIBS_LEASEDCHUNK_HPP_
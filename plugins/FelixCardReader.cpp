@@ -6,6 +6,7 @@
  * received with this code.
  */
 #include "flxlibs/felixcardreader/Nljs.hpp"
+#include "flxlibs/felixcardreaderinfo/InfoNljs.hpp"
 
 #include "CreateElink.hpp"
 #include "FelixCardReader.hpp"
@@ -15,8 +16,12 @@
 
 #include "flxcard/FlxException.h"
 
+#include <algorithm>
 #include <chrono>
+#include <map>
 #include <memory>
+#include <set>
+#include <sstream>
 #include <string>
 #include <thread>
 #include <utility>
@@ -48,7 +53,6 @@ FelixCardReader::FelixCardReader(const std::string& name)
   , m_links_enabled({0})
   , m_num_links(0)
   , m_block_size(0)
-  , m_block_router(nullptr)
 //, block_ptr_sinks_{ }
 
 {
@@ -57,6 +61,13 @@ FelixCardReader::FelixCardReader(const std::string& name)
   register_command("conf", &FelixCardReader::do_configure);
   register_command("start", &FelixCardReader::do_start);
   register_command("stop", &FelixCardReader::do_stop);
+  register_command("scrap", &FelixCardReader::do_scrap);
+}
+
+inline uint64_t // NOLINT(build/unsigned)
+ns_since(std::chrono::steady_clock::time_point t0)
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count();
 }
 
 inline void
@@ -101,39 +112,34 @@ FelixCardReader::init(const data_t& args)
       m_elinks[linkid]->init(args, m_block_queue_capacity);
     }
   }
+  // Configure pairs the queues with links_enabled in link ID order
+  m_elink_keys.clear();
+  for (auto& [linkid, elink] : m_elinks) {
+    m_elink_keys.push_back(linkid);
+  }
+}
 
-  // Router function of block to appropriate ElinkHandlers
-  m_block_router = [&](uint64_t block_addr) { // NOLINT
-    // block_counter++;
-    const auto* block = const_cast<felix::packetformat::block*>(
-      felix::packetformat::block_from_bytes(reinterpret_cast<const char*>(block_addr)) // NOLINT
-    );
-    auto elink = block->elink;
-    if (m_elinks.count(elink) != 0) {
-      m_elinks[elink]->queue_in_block_address(block_addr);
-    } else {
-      // Really bad -> unexpeced ELINK ID in Block.
-      // This check is needed in order to avoid dynamically add thousands
-      // of ELink parser implementations on the fly, in case the data
-      // corruption is extremely severe.
-      //
-      // Possible causes:
-      //   -> enabled links that don't connect to anything
-      //   -> unexpected format (fw/sw version missmatch)
-      //   -> data corruption from FE
-      //   -> data corruption from CR (really rare, last possible cause)
-
-      // NO TLOG_DEBUG, but should count and periodically report corrupted DMA blocks.
-    }
-  };
-
-  // Set function for the CardWrapper's block processor.
-  m_card_wrapper->set_block_addr_handler(m_block_router);
+template<typename Function>
+void
+FelixCardReader::for_each_elink(Function&& transition)
+{
+  // Stops wait for the parser threads to drain their queues, one thread per elink overlaps them
+  std::vector<std::future<void>> done;
+  done.reserve(m_elinks.size());
+  for (auto& [tag, elink] : m_elinks) {
+    ElinkConcept* target = elink.get();
+    done.push_back(std::async(std::launch::async, [&transition, target]() { transition(*target); }));
+  }
+  for (auto& d : done) {
+    d.get();
+  }
 }
 
 void
 FelixCardReader::do_configure(const data_t& args)
 {
+    auto t0 = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> config_lock(m_config_mutex);
     m_cfg = args.get<felixcardreader::Conf>();
     m_card_id = m_cfg.card_id;
     m_logical_unit = m_cfg.logical_unit;
@@ -162,44 +168,250 @@ FelixCardReader::do_configure(const data_t& args)
     TLOG(TLVL_WORK_STEPS) << "Card ID: " << m_card_id;
     TLOG(TLVL_WORK_STEPS) << "Configuring components with Block size:" << m_block_size
                           << " & trailer size: " << m_chunk_trailer_size;
-    m_card_wrapper->configure(args);
-    // get linkids defined by queues
-    std::vector<int> linkids;
-    for(auto& [id, elink] : m_elinks) {
-      linkids.push_back(id);
+    std::set<unsigned int> inline_links(m_cfg.inline_parse_links.begin(), m_cfg.inline_parse_links.end());
+    for (auto link : inline_links) {
+      if (std::find(m_links_enabled.begin(), m_links_enabled.end(), link) == m_links_enabled.end()) {
+        ers::fatal(ConfigurationError(ERS_HERE, "Inline parse link " + std::to_string(link) + " is not enabled."));
+      }
     }
-    // loop through all elinkmodels, change the linkids to link tags and configure
+    m_card_wrapper->configure(args);
+    // Key the elinks of the queues by the tags of their links. The keys are tags of the
+    // previous configuration after a scrap, so the elinks move to a fresh map.
+    std::map<int, std::unique_ptr<ElinkConcept>> elinks;
     for (unsigned i = 0; i < m_num_links; ++i) {
-      auto elink = m_elinks.extract(linkids[i]);
+      auto elink = m_elinks.extract(m_elink_keys[i]);
       auto tag = m_links_enabled[i] * m_elink_multiplier;
       elink.key() = tag;
-      m_elinks.insert(std::move(elink));
+      if (!elinks.insert(std::move(elink)).inserted) {
+        ers::fatal(ConfigurationError(ERS_HERE, "Link " + std::to_string(m_links_enabled[i]) + " is enabled twice."));
+      }
+      m_elink_keys[i] = tag;
+    }
+    m_elinks = std::move(elinks);
+    for (unsigned i = 0; i < m_num_links; ++i) {
+      auto tag = m_links_enabled[i] * m_elink_multiplier;
       m_elinks[tag]->set_ids(m_card_id, m_logical_unit, m_links_enabled[i], tag);
+      m_elinks[tag]->set_cpus(thread_cpus(m_cfg.elink_cpus, m_cfg.numa_id, i));
+      m_elinks[tag]->set_inline_parse(inline_links.count(m_links_enabled[i]) != 0);
+      m_elinks[tag]->set_wait_policy(m_cfg.parser_spin_count, m_cfg.parser_yield_count);
+      m_elinks[tag]->set_parse_batch(m_cfg.parser_batch_blocks);
+      m_elinks[tag]->set_native_decoder(m_cfg.native_block_decoder);
       m_elinks[tag]->conf(args, m_block_size, is_32b_trailer);
     }
+    if (!inline_links.empty()) {
+      TLOG(TLVL_WORK_STEPS) << "Card " << m_card_id << " parses " << inline_links.size()
+                            << " links inline on the DMA threads.";
+    }
+
+    // Parser workers take the queued elinks in links_enabled order, round robin
+    m_parser_pool.reset();
+    if (m_cfg.parser_workers > 0) {
+      std::vector<ElinkConcept*> pool_elinks;
+      for (auto link : m_links_enabled) {
+        if (inline_links.count(link) == 0) {
+          pool_elinks.push_back(m_elinks[link * m_elink_multiplier].get());
+        }
+      }
+      std::vector<std::vector<int>> worker_cpus;
+      for (size_t w = 0; w < m_cfg.parser_workers; ++w) {
+        worker_cpus.push_back(thread_cpus(m_cfg.elink_cpus, m_cfg.numa_id, w));
+      }
+      m_parser_pool = std::make_unique<ParserWorkerPool>(pool_elinks,
+                                                         m_cfg.parser_workers,
+                                                         m_cfg.parser_batch_blocks,
+                                                         m_cfg.parser_spin_count,
+                                                         m_cfg.parser_yield_count,
+                                                         worker_cpus,
+                                                         m_card_id,
+                                                         m_logical_unit);
+      TLOG(TLVL_WORK_STEPS) << "Card " << m_card_id << " parses " << pool_elinks.size() << " elinks with "
+                            << m_cfg.parser_workers << " parser workers.";
+    }
+    for (auto& [tag, elink] : m_elinks) {
+      elink->set_parser_pool(m_parser_pool.get());
+    }
+
+    // Map links to DMA descriptors. Every DMA descriptor gets its own router, that only
+    // queues blocks of its own links, so that each elink queue has a single producer thread.
+    std::map<int, std::vector<unsigned int>> dma_links;
+    if (m_cfg.dma_descriptors.empty()) {
+      dma_links[m_cfg.dma_id] = m_links_enabled;
+    } else {
+      for (const auto& descriptor : m_cfg.dma_descriptors) {
+        dma_links[descriptor.dma_id] = descriptor.links;
+      }
+    }
+    std::set<unsigned int> mapped_links;
+    m_routing_tables.clear();
+    for (const auto& [dma_id, links] : dma_links) {
+      auto table = std::make_unique<ElinkRoutingTable>();
+      for (auto link : links) {
+        auto tag = link * m_elink_multiplier;
+        if (m_elinks.count(tag) == 0 || !mapped_links.insert(link).second) {
+          ers::fatal(ConfigurationError(
+            ERS_HERE, "Link " + std::to_string(link) + " is not enabled or belongs to more than one DMA descriptor."));
+        }
+        if (!table->add(tag, m_elinks[tag].get())) {
+          ers::fatal(ConfigurationError(ERS_HERE, "Elink tag " + std::to_string(tag) + " of link " +
+                                                    std::to_string(link) + " doesn't fit the block header."));
+        }
+      }
+      TLOG(TLVL_WORK_STEPS) << "DMA descriptor " << dma_id << " carries " << table->size() << " links.";
+
+      // Router function of block spans to appropriate ElinkHandlers
+      ElinkRoutingTable* routes = table.get();
+      m_routing_tables[dma_id] = std::move(table);
+      // With zero-copy chunks every block handed out is held until its elink releases it
+      DmaLeaseTable* leases = m_card_wrapper->get_lease_table(dma_id);
+      for (auto link : links) {
+        m_elinks[link * m_elink_multiplier]->set_lease_table(leases);
+      }
+      m_block_routers[dma_id] = [routes, leases](uint64_t first_block_addr, size_t count) { // NOLINT
+        if (leases != nullptr) {
+          leases->hold_span(first_block_addr, count);
+        }
+        size_t lost = 0;
+        for (size_t i = 0; i < count; ++i) {
+          uint64_t block_addr = first_block_addr + i * CardWrapper::get_block_size(); // NOLINT
+          const auto* block = const_cast<felix::packetformat::block*>(
+            felix::packetformat::block_from_bytes(reinterpret_cast<const char*>(block_addr)) // NOLINT
+          );
+          const auto& route = routes->route(block->elink);
+          if (route.elink != nullptr) {
+            lost += route.elink->check_block_seqnum(block->seqnum);
+            route.enqueue(route.elink, block_addr);
+          } else {
+            routes->count_unknown(block->elink);
+            if (leases != nullptr) {
+              leases->release(block_addr);
+            }
+            // Really bad -> unexpeced ELINK ID in Block.
+            // This check is needed in order to avoid dynamically add thousands
+            // of ELink parser implementations on the fly, in case the data
+            // corruption is extremely severe.
+            //
+            // Possible causes:
+            //   -> enabled links that don't connect to anything
+            //   -> links sent through another DMA descriptor than configured
+            //   -> unexpected format (fw/sw version missmatch)
+            //   -> data corruption from FE
+            //   -> data corruption from CR (really rare, last possible cause)
+
+            // NO TLOG_DEBUG, counted per elink ID and reported in RouterInfo.
+          }
+        }
+        routes->notify_parsers();
+        return lost;
+      };
+
+      // Set function for the CardWrapper's block processor of this DMA descriptor.
+      m_card_wrapper->set_block_span_handler(dma_id, m_block_routers[dma_id]);
+    }
+    if (mapped_links.size() != m_num_links) {
+      ers::fatal(ConfigurationError(ERS_HERE, "Not every enabled link is assigned to a DMA descriptor."));
+    }
+    m_configured = true;
+    m_transition_stats.configure_ns.store(ns_since(t0));
 }
 
 void
 FelixCardReader::do_start(const data_t& args)
 {
+    auto t0 = std::chrono::steady_clock::now();
     m_card_wrapper->start(args);
-    for (auto& [tag, elink] : m_elinks) {
-      elink->start(args);
-    }
+    m_transition_stats.start_card_ns.store(ns_since(t0));
+    t0 = std::chrono::steady_clock::now();
+    for_each_elink([&args](ElinkConcept& elink) { elink.start(args); });
+    m_transition_stats.start_elinks_ns.store(ns_since(t0));
 }
 
 void
 FelixCardReader::do_stop(const data_t& args)
 {
+    // The drain of the DMA buffers and of the elink queues shares one timeout
+    auto t0 = std::chrono::steady_clock::now();
+    for (auto& [tag, elink] : m_elinks) {
+      elink->set_drain_deadline(t0 + std::chrono::milliseconds(m_cfg.drain_timeout));
+    }
     m_card_wrapper->stop(args);
+    m_transition_stats.stop_card_ns.store(ns_since(t0));
+    auto t1 = std::chrono::steady_clock::now();
+    for_each_elink([&args](ElinkConcept& elink) { elink.stop(args); });
+    m_transition_stats.stop_elinks_ns.store(ns_since(t1));
+    TLOG(TLVL_WORK_STEPS) << "Card " << m_card_id << " stopped in " << ns_since(t0) / 1e6 << " ms.";
+}
+
+void
+FelixCardReader::do_scrap(const data_t& args)
+{
+    // The card wrapper keeps its DMA buffers, a conf with the same buffer size reuses them
+    auto t0 = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> config_lock(m_config_mutex);
+    m_card_wrapper->scrap(args);
     for (auto& [tag, elink] : m_elinks) {
-      elink->stop(args);
+      elink->scrap(args);
+      elink->set_parser_pool(nullptr);
     }
+    m_parser_pool.reset();
+    m_block_routers.clear();
+    m_routing_tables.clear();
+    m_configured = false;
+    m_transition_stats.scrap_ns.store(ns_since(t0));
+    TLOG(TLVL_WORK_STEPS) << "Card " << m_card_id << " scrapped in " << ns_since(t0) / 1e6 << " ms.";
 }
 
 void
 FelixCardReader::get_info(opmonlib::InfoCollector& ci, int level)
 {
+    std::lock_guard<std::mutex> config_lock(m_config_mutex);
+    m_card_wrapper->get_info(ci, level);
+
+    felixcardreaderinfo::TransitionInfo info;
+    info.card_id = m_card_id;
+    info.logical_unit = m_logical_unit;
+    info.configure_time_ms = m_transition_stats.configure_ns.load() / 1e6;
+    info.start_card_time_ms = m_transition_stats.start_card_ns.load() / 1e6;
+    info.start_elinks_time_ms = m_transition_stats.start_elinks_ns.load() / 1e6;
+    info.stop_card_time_ms = m_transition_stats.stop_card_ns.load() / 1e6;
+    info.stop_elinks_time_ms = m_transition_stats.stop_elinks_ns.load() / 1e6;
+    info.scrap_time_ms = m_transition_stats.scrap_ns.load() / 1e6;
+    opmonlib::InfoCollector transition_ci;
+    transition_ci.add(info);
+    ci.add("transitions_" + std::to_string(m_card_id) + "_" + std::to_string(m_logical_unit), transition_ci);
+
+    // Unknown elinks of all DMA descriptors, the most frequent ones by name
+    felixcardreaderinfo::RouterInfo router_info;
+    router_info.card_id = m_card_id;
+    router_info.logical_unit = m_logical_unit;
+    std::vector<std::pair<uint64_t, unsigned>> unknown; // NOLINT(build/unsigned)
+    std::map<unsigned, uint64_t> unknown_per_elink;     // NOLINT(build/unsigned)
+    for (auto& [dma_id, table] : m_routing_tables) {
+      auto& stats = table->get_unknown_stats();
+      router_info.num_unknown_elink_blocks += stats.unknown_elink_ctr.exchange(0);
+      for (unsigned tag = 0; tag < stats.unknown_elink_hist.size(); ++tag) {
+        if (stats.unknown_elink_hist[tag].load(std::memory_order_relaxed) != 0) {
+          unknown_per_elink[tag] += stats.unknown_elink_hist[tag].exchange(0);
+        }
+      }
+    }
+    for (const auto& [tag, blocks] : unknown_per_elink) {
+      unknown.emplace_back(blocks, tag);
+    }
+    std::sort(unknown.rbegin(), unknown.rend());
+    router_info.num_unknown_elinks = unknown.size();
+    std::ostringstream unknown_oss;
+    for (size_t i = 0; i < std::min(unknown.size(), m_max_reported_unknown_elinks); ++i) {
+      unknown_oss << (i ? "," : "") << unknown[i].second << ":" << unknown[i].first;
+    }
+    router_info.unknown_elinks = unknown_oss.str();
+    opmonlib::InfoCollector router_ci;
+    router_ci.add(router_info);
+    ci.add("router_" + std::to_string(m_card_id) + "_" + std::to_string(m_logical_unit), router_ci);
+
+    if (m_parser_pool != nullptr) {
+      m_parser_pool->get_info(ci, level);
+    }
+
     for (unsigned lid = 0; lid < m_num_links; ++lid) {
       auto tag = m_links_enabled[lid] * m_elink_multiplier;
       m_elinks[tag]->get_info(ci, level);
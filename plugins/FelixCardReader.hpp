@@ -23,10 +23,14 @@
 
 #include "CardWrapper.hpp"
 #include "ElinkConcept.hpp"
+#include "ElinkRoutingTable.hpp"
+#include "FelixStatistics.hpp"
+#include "ParserWorkerPool.hpp"
 
 #include <future>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -57,13 +61,20 @@ private:
   static constexpr size_t m_block_queue_capacity = 1000000;
   static constexpr size_t m_1kb_block_size = 1024;
   static constexpr int m_32b_trailer_size = 32;
+  static constexpr size_t m_max_reported_unknown_elinks = 8;
 
   // Commands
   void do_configure(const data_t& args);
   void do_start(const data_t& args);
   void do_stop(const data_t& args);
+  void do_scrap(const data_t& args);
   void get_info(opmonlib::InfoCollector& ci, int level);
 
+  // Runs a transition on all elinks concurrently and returns when every one finished
+  template<typename Function>
+  void for_each_elink(Function&& transition);
+  stats::TransitionStats m_transition_stats;
+
   // Configuration
   bool m_configured;
   module_conf_t m_cfg;
@@ -81,9 +92,17 @@ private:
 
   // ElinkConcept
   std::map<int, std::unique_ptr<ElinkConcept>> m_elinks;
+  // Key in m_elinks of the elink of each output queue, in link ID order of the queues
+  std::vector<int> m_elink_keys;
+
+  // Parser workers of all elinks, if configured
+  std::unique_ptr<ParserWorkerPool> m_parser_pool;
 
-  // Function for routing block addresses from card to elink handler
-  std::function<void(uint64_t)> m_block_router; // NOLINT
+  // Functions for routing spans of block addresses from card to elink handler, per DMA descriptor
+  std::map<int, std::unique_ptr<ElinkRoutingTable>> m_routing_tables;
+  std::map<int, std::function<size_t(uint64_t, size_t)>> m_block_routers; // NOLINT
+  // Held by configure and scrap while they change the containers above, and by get_info
+  std::mutex m_config_mutex;
 };
 
 } // namespace dunedaq::flxlibs
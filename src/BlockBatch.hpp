@@ -0,0 +1,61 @@
+/**
+ * @file BlockBatch.hpp Takes a batch of block addresses from an elink queue and
+ * parses them with the next block prefetched
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef FLXLIBS_SRC_BLOCKBATCH_HPP_
+#define FLXLIBS_SRC_BLOCKBATCH_HPP_
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace dunedaq::flxlibs {
+
+// Largest batch taken from a queue at once, bounds the stack use of a batch
+constexpr size_t s_max_block_batch = 512;
+
+// Block header and the first data line, and the last line with the trailer of 32b trailer blocks
+inline void
+prefetch_block(uint64_t block_addr, size_t block_size) // NOLINT(build/unsigned)
+{
+  const auto* block = reinterpret_cast<const char*>(block_addr); // NOLINT
+  __builtin_prefetch(block);
+  __builtin_prefetch(block + 64);
+  __builtin_prefetch(block + block_size - 64);
+}
+
+/**
+ * @brief Reads up to max_blocks addresses from the queue first, which frees their slots
+ * for the router at once, then calls parse(block_addr) for each, while the next block
+ * is prefetched. Returns the number of blocks parsed.
+ */
+template<typename Queue, typename Parse>
+size_t
+parse_block_batch(Queue& queue, size_t max_blocks, size_t block_size, Parse&& parse)
+{
+  std::array<uint64_t, s_max_block_batch> batch; // NOLINT(build/unsigned)
+  max_blocks = std::min(max_blocks, s_max_block_batch);
+  size_t count = 0;
+  while (count < max_blocks && queue.read(batch[count])) {
+    ++count;
+  }
+  if (count != 0) {
+    prefetch_block(batch[0], block_size);
+  }
+  for (size_t i = 0; i < count; ++i) {
+    if (i + 1 < count) {
+      prefetch_block(batch[i + 1], block_size);
+    }
+    parse(batch[i]);
+  }
+  return count;
+}
+
+} // namespace dunedaq::flxlibs
+
+#endif // FLXLIBS_SRC_BLOCKBATCH_HPP_
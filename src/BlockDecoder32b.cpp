@@ -0,0 +1,188 @@
+/**
+ * @file BlockDecoder32b.cpp Trailer walk and classification of the native 32 bit
+ * trailer block decoder, scalar and AVX2
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+// From Module
+#include "BlockDecoder32b.hpp"
+
+// From STD
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace dunedaq {
+namespace flxlibs {
+
+namespace {
+
+inline uint32_t // NOLINT(build/unsigned)
+load_trailer(const char* addr)
+{
+  uint32_t word; // NOLINT(build/unsigned)
+  std::memcpy(&word, addr, sizeof(word));
+  return word;
+}
+
+// Payload plus padding plus trailer
+inline size_t
+subchunk_step(uint32_t word) // NOLINT(build/unsigned)
+{
+  return BlockDecoder32b::s_trailer_size + blockformat::padded_length(word & 0xFFFF, BlockDecoder32b::s_trailer_size);
+}
+
+#if defined(__x86_64__)
+bool
+cpu_has_avx2()
+{
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  return has_avx2;
+}
+#endif
+
+} // namespace
+
+BlockDecoder32b::BlockDecoder32b(bool use_simd)
+#if defined(__x86_64__)
+  : m_use_simd(use_simd && cpu_has_avx2())
+#else
+  : m_use_simd(false)
+#endif
+{}
+
+void
+BlockDecoder32b::configure(size_t block_size)
+{
+  m_block_size = block_size;
+  // At most one trailer per 4 bytes, plus room for the last 8-wide store
+  size_t max_subchunks = (block_size - blockformat::header_size) / s_trailer_size + 8;
+  m_offsets.resize(max_subchunks);
+  m_words.resize(max_subchunks);
+  m_kinds.resize(max_subchunks);
+  m_chunk.m_data.reserve(max_subchunks);
+  m_chunk.m_lengths.reserve(max_subchunks);
+}
+
+bool
+BlockDecoder32b::locate(const char* block)
+{
+#if defined(__x86_64__)
+  if (m_use_simd) {
+    if (!locate_avx2(block)) {
+      return false;
+    }
+    classify_avx2();
+    return true;
+  }
+#endif
+  if (!locate_scalar(block)) {
+    return false;
+  }
+  classify_scalar(0);
+  return true;
+}
+
+bool
+BlockDecoder32b::locate_scalar(const char* block)
+{
+  size_t end = m_block_size;
+  size_t n = 0;
+  while (end - blockformat::header_size >= s_trailer_size) {
+    uint32_t word = load_trailer(block + end - s_trailer_size); // NOLINT(build/unsigned)
+    size_t step = subchunk_step(word);
+    if (step > end - blockformat::header_size) {
+      return false;
+    }
+    end -= step;
+    m_offsets[n] = static_cast<uint32_t>(end); // NOLINT(build/unsigned)
+    m_words[n] = word;
+    ++n;
+  }
+  m_num_subchunks = n;
+  return end == blockformat::header_size;
+}
+
+void
+BlockDecoder32b::classify_scalar(size_t from)
+{
+  for (size_t i = from; i < m_num_subchunks; ++i) {
+    m_kinds[i] = static_cast<uint8_t>(m_words[i] >> 26); // NOLINT(build/unsigned)
+  }
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2"))) bool
+BlockDecoder32b::locate_avx2(const char* block)
+{
+  const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i length_mask = _mm256_set1_epi32(0xFFFF);
+  size_t end = m_block_size;
+  size_t n = 0;
+  size_t scalar_steps = 0;
+  while (end - blockformat::header_size >= s_trailer_size) {
+    uint32_t word = load_trailer(block + end - s_trailer_size); // NOLINT(build/unsigned)
+    size_t step = subchunk_step(word);
+
+    // Speculate that this and the next seven subchunks have the same length: gather their
+    // trailers and keep them if all lengths match, each one then sits where the walk would
+    // find it. After a miss, walk eight subchunks one by one before speculating again.
+    if (scalar_steps == 0 && 8 * step <= end - blockformat::header_size) {
+      const __m256i back = _mm256_mullo_epi32(lane, _mm256_set1_epi32(-static_cast<int>(step)));
+      const __m256i words =
+        _mm256_i32gather_epi32(reinterpret_cast<const int*>(block + end - s_trailer_size), back, 1); // NOLINT
+      const __m256i same = _mm256_cmpeq_epi32(_mm256_and_si256(words, length_mask),
+                                              _mm256_set1_epi32(static_cast<int>(word & 0xFFFF)));
+      if (_mm256_movemask_epi8(same) == -1) {
+        const __m256i offsets = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(end - step)), back);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(&m_words[n]), words);     // NOLINT
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(&m_offsets[n]), offsets); // NOLINT
+        n += 8;
+        end -= 8 * step;
+        continue;
+      }
+      scalar_steps = 8;
+    }
+
+    if (step > end - blockformat::header_size) {
+      return false;
+    }
+    end -= step;
+    m_offsets[n] = static_cast<uint32_t>(end); // NOLINT(build/unsigned)
+    m_words[n] = word;
+    ++n;
+    if (scalar_steps != 0) {
+      --scalar_steps;
+    }
+  }
+  m_num_subchunks = n;
+  return end == blockformat::header_size;
+}
+
+__attribute__((target("avx2"))) void
+BlockDecoder32b::classify_avx2()
+{
+  // Byte 3 of every trailer, then both 128 bit lanes side by side
+  const __m256i top_bytes = _mm256_setr_epi8(3, 7, 11, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                             3, 7, 11, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m256i lanes = _mm256_setr_epi32(0, 4, 1, 1, 1, 1, 1, 1);
+  const __m128i kind_mask = _mm_set1_epi8(0x3F);
+  size_t i = 0;
+  for (; i + 8 <= m_num_subchunks; i += 8) {
+    __m256i words = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&m_words[i])); // NOLINT
+    __m256i bytes = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(words, top_bytes), lanes);
+    __m128i kinds = _mm_and_si128(_mm_srli_epi16(_mm256_castsi256_si128(bytes), 2), kind_mask);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(&m_kinds[i]), kinds); // NOLINT
+  }
+  classify_scalar(i);
+}
+
+#endif
+
+} // namespace flxlibs
+} // namespace dunedaq
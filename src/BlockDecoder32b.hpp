@@ -0,0 +1,208 @@
+/**
+ * @file BlockDecoder32b.hpp Native decoder of FELIX blocks with 32 bit subchunk
+ * trailers, an alternative to packetformat's BlockParser
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef FLXLIBS_SRC_BLOCKDECODER32B_HPP_
+#define FLXLIBS_SRC_BLOCKDECODER32B_HPP_
+
+#include "FelixBlockFormat.hpp"
+
+#include "packetformat/block_format.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace dunedaq::flxlibs {
+
+/**
+ * @brief Chunk assembled by BlockDecoder32b from subchunks of one or more blocks. It
+ * references the blocks in the DMA buffer and has the accessors of
+ * felix::packetformat::chunk that the parser policies use.
+ */
+class DecodedChunk
+{
+public:
+  const char* const* subchunks() const { return m_data.data(); }
+  const unsigned* subchunk_lengths() const { return m_lengths.data(); }
+  unsigned subchunk_number() const { return static_cast<unsigned>(m_data.size()); }
+  unsigned length() const { return m_length; }
+
+private:
+  friend class BlockDecoder32b;
+
+  std::vector<const char*> m_data;
+  std::vector<unsigned> m_lengths;
+  unsigned m_length{ 0 };
+  bool m_error{ false };
+};
+
+/**
+ * @brief Decodes a block in two passes. locate() walks the trailers from the back of the
+ * block and classifies them into a batch of subchunk descriptors, decode() then emits the
+ * events of the descriptors to the parser operations, in block order.
+ *
+ * The walk is a serial dependency: the position of a trailer follows from the length in
+ * the one after it. With AVX2 the walk speculates that the next eight subchunks have the
+ * length of the current one, gathers their trailers at once and keeps them if all lengths
+ * match, which is the common case of links with fixed size payloads. The classification
+ * extracts the type and error bits of eight trailers per step. Without AVX2, or with
+ * use_simd false, both passes are scalar and produce the same descriptors.
+ *
+ * Events follow packetformat's BlockParser: subchunk_processed or
+ * subchunk_processed_with_error per non-null subchunk, shortchunk_processed for a chunk in
+ * one subchunk, chunk_processed for a chunk over several subchunks and blocks, the
+ * _with_error variants if a subchunk of the chunk had an error flag, and block_processed.
+ * A chunk interrupted by a new first subchunk is emitted with error, middle and last
+ * subchunks without a first one are dropped.
+ */
+class BlockDecoder32b
+{
+public:
+  static constexpr size_t s_trailer_size = sizeof(uint32_t);
+
+  explicit BlockDecoder32b(bool use_simd = true);
+
+  void configure(size_t block_size);
+  bool uses_simd() const { return m_use_simd; }
+
+  // Fills the descriptors of the subchunks of the block, last subchunk first. Returns false
+  // if the trailers don't add up to the block size.
+  bool locate(const char* block);
+
+  size_t num_subchunks() const { return m_num_subchunks; }
+  uint32_t subchunk_offset(size_t i) const { return m_offsets[i]; }      // NOLINT(build/unsigned)
+  uint32_t subchunk_length(size_t i) const { return m_words[i] & 0xFFFF; } // NOLINT(build/unsigned)
+  // Trailer bits 31:26: type[5:3] trunc[2] err[1] crcerr[0]
+  uint8_t subchunk_kind(size_t i) const { return m_kinds[i]; } // NOLINT(build/unsigned)
+
+  template<class Ops>
+  void decode(const felix::packetformat::block* block, Ops& ops)
+  {
+    if (block->sob != blockformat::sob_32b_trailer) {
+      ops.block_processed_with_error(*block);
+      return;
+    }
+    const char* base = reinterpret_cast<const char*>(block); // NOLINT
+    if (!locate(base)) {
+      if (m_in_chunk) {
+        emit_chunk(ops, true);
+      }
+      ops.block_processed_with_error(*block);
+      return;
+    }
+
+    for (size_t i = m_num_subchunks; i-- != 0;) {
+      const uint8_t kind = m_kinds[i]; // NOLINT(build/unsigned)
+      const auto type = static_cast<blockformat::SubchunkType>(kind >> 3);
+      if (type == blockformat::SubchunkType::kNull) {
+        continue;
+      }
+      const bool error = (kind & 0x7) != 0;
+      const char* data = base + m_offsets[i];
+      const unsigned length = m_words[i] & 0xFFFF;
+
+      felix::packetformat::subchunk subchunk{};
+      subchunk.data = data;
+      subchunk.length = length;
+      subchunk.trunc_flag = (kind & 0x4) != 0;
+      subchunk.err_flag = (kind & 0x2) != 0;
+      subchunk.crcerr_flag = (kind & 0x1) != 0;
+      if (error) {
+        ops.subchunk_processed_with_error(subchunk);
+      } else {
+        ops.subchunk_processed(subchunk);
+      }
+
+      switch (type) {
+        case blockformat::SubchunkType::kBoth: {
+          if (m_in_chunk) {
+            emit_chunk(ops, true);
+          }
+          felix::packetformat::shortchunk shortchunk{};
+          shortchunk.data = data;
+          shortchunk.length = length;
+          if (error) {
+            ops.shortchunk_process_with_error(shortchunk);
+          } else {
+            ops.shortchunk_processed(shortchunk);
+          }
+          break;
+        }
+        case blockformat::SubchunkType::kFirst:
+          if (m_in_chunk) {
+            emit_chunk(ops, true);
+          }
+          m_in_chunk = true;
+          append(data, length, error);
+          break;
+        case blockformat::SubchunkType::kMiddle:
+          if (m_in_chunk) {
+            append(data, length, error);
+          }
+          break;
+        case blockformat::SubchunkType::kLast:
+          if (m_in_chunk) {
+            append(data, length, error);
+            emit_chunk(ops, m_chunk.m_error);
+          }
+          break;
+        default: // timeout and out of band subchunks carry no chunk data
+          break;
+      }
+    }
+    ops.block_processed(*block);
+  }
+
+private:
+  bool locate_scalar(const char* block);
+  void classify_scalar(size_t from);
+#if defined(__x86_64__)
+  bool locate_avx2(const char* block);
+  void classify_avx2();
+#endif
+
+  void append(const char* data, unsigned length, bool error)
+  {
+    m_chunk.m_data.push_back(data);
+    m_chunk.m_lengths.push_back(length);
+    m_chunk.m_length += length;
+    m_chunk.m_error |= error;
+  }
+
+  template<class Ops>
+  void emit_chunk(Ops& ops, bool error)
+  {
+    if (error) {
+      ops.chunk_processed_with_error(m_chunk);
+    } else {
+      ops.chunk_processed(m_chunk);
+    }
+    m_chunk.m_data.clear();
+    m_chunk.m_lengths.clear();
+    m_chunk.m_length = 0;
+    m_chunk.m_error = false;
+    m_in_chunk = false;
+  }
+
+  bool m_use_simd;
+  size_t m_block_size{ 0 };
+
+  // Descriptors of the subchunks of the current block, last subchunk first
+  size_t m_num_subchunks{ 0 };
+  std::vector<uint32_t> m_offsets; // NOLINT(build/unsigned)
+  std::vector<uint32_t> m_words;   // NOLINT(build/unsigned)
+  std::vector<uint8_t> m_kinds;    // NOLINT(build/unsigned)
+
+  // Chunk continued from earlier subchunks, possibly of earlier blocks
+  DecodedChunk m_chunk;
+  bool m_in_chunk{ false };
+};
+
+} // namespace dunedaq::flxlibs
+
+#endif // FLXLIBS_SRC_BLOCKDECODER32B_HPP_
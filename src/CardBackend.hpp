@@ -0,0 +1,71 @@
+/**
+ * @file CardBackend.hpp Interface of the card operations used by CardWrapper
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef FLXLIBS_SRC_CARDBACKEND_HPP_
+#define FLXLIBS_SRC_CARDBACKEND_HPP_
+
+#include <sys/types.h>
+
+#include <cstdint>
+
+namespace dunedaq::flxlibs {
+
+/**
+ * @brief The subset of FlxCard and CMEM functionality that the DMA readout relies on.
+ * Implemented by the FlxCard driver backend and by a software emulation that
+ * lets the DMA to block handler pipeline run without a FELIX card.
+ */
+class CardBackend
+{
+public:
+  CardBackend() = default;
+  virtual ~CardBackend() = default;
+  CardBackend(const CardBackend&) = delete;            ///< CardBackend is not copy-constructible
+  CardBackend& operator=(const CardBackend&) = delete; ///< CardBackend is not copy-assignable
+  CardBackend(CardBackend&&) = delete;                 ///< CardBackend is not move-constructible
+  CardBackend& operator=(CardBackend&&) = delete;      ///< CardBackend is not move-assignable
+
+  // Card
+  virtual void card_open(int absolute_card_id) = 0;
+  virtual void card_close() = 0;
+  // Whether the DMA addresses given to the card are virtual addresses of this process
+  virtual bool virtual_dma_addresses() const = 0;
+
+  // Resets and interrupts
+  virtual void dma_reset() = 0;
+  virtual void soft_reset() = 0;
+  virtual void irq_reset_counters() = 0;
+  virtual void irq_enable(unsigned irq) = 0;
+  virtual void irq_disable() = 0;
+  virtual void irq_wait(unsigned irq) = 0;
+  // Makes a thread blocked in irq_wait(irq) return, or the next call if none is blocked
+  virtual void irq_cancel(unsigned irq) = 0;
+
+  // Interrupts for the interrupt dispatcher: an eventfd that is written when irq fires,
+  // or -1 if the backend can only block in irq_wait. irq_ack re-arms irq before its
+  // handler looks at the DMA buffer, so that no data arrival is missed.
+  virtual int interrupt_fd(unsigned /*irq*/) { return -1; }
+  virtual void irq_ack(unsigned /*irq*/) {}
+
+  // DMA to host
+  virtual void dma_to_host(unsigned dma_id, u_long paddr, u_long size, unsigned flags) = 0; // NOLINT
+  virtual void dma_stop(unsigned dma_id) = 0;
+
+  // Read and write pointers of a running DMA descriptor. These are the per block hot path:
+  // they touch only the registers of dma_id and must be safe to call without holding any
+  // lock, concurrently with control operations and with irq_wait on other threads.
+  virtual void dma_set_ptr(unsigned dma_id, u_long paddr) = 0; // NOLINT
+  virtual uint64_t current_address(unsigned dma_id) = 0;       // NOLINT
+
+  // Whether the to-host path was busy (FIFOs almost full, data at risk) since the last
+  // call. Clears the latch. Control path: call under the card lock. False if unknown.
+  virtual bool tohost_busy_latched() { return false; }
+};
+
+} // namespace dunedaq::flxlibs
+
+#endif // FLXLIBS_SRC_CARDBACKEND_HPP_
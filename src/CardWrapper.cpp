@@ -7,18 +7,28 @@
  */
 // From Module
 #include "CardWrapper.hpp"
+#include "CreateCardBackend.hpp"
+#include "CreateDmaBufferAllocator.hpp"
 #include "FelixDefinitions.hpp"
 #include "FelixIssues.hpp"
+#include "ThreadAffinity.hpp"
 
+#include "flxlibs/felixcardreaderinfo/InfoNljs.hpp"
 #include "logging/Logging.hpp"
 
 #include "flxcard/FlxException.h"
 #include "packetformat/block_format.hpp"
 
 // From STD
+#include <algorithm>
+#include <sched.h>
 #include <chrono>
 #include <memory>
 #include <string>
+#include <thread>
+
+#include <sys/timerfd.h>
+#include <unistd.h>
 
 /**
  * @brief TRACE debug levels used in this source file
@@ -38,16 +48,22 @@ CardWrapper::CardWrapper()
   , m_card_id(0)
   , m_logical_unit(0)
   , m_card_id_str("")
-  , m_dma_id(0)
   , m_margin_blocks(0)
   , m_block_threshold(0)
+  , m_flush_timeout(0)
+  , m_drain_timeout(0)
+  , m_lease_timeout(0)
+  , m_reset_on_stop(true)
+  , m_adaptive_threshold(false)
   , m_interrupt_mode(false)
+  , m_hybrid_mode(false)
+  , m_hybrid_high_water_blocks(0)
+  , m_hybrid_poll_timeout(0)
   , m_poll_time(0)
   , m_numa_id(0)
   , m_links_enabled({0})
   , m_info_str("")
   , m_run_lock{ false }
-  , m_dma_processor(0)
   , m_handle_block_addr(nullptr)
 {}
 
@@ -56,16 +72,17 @@ CardWrapper::~CardWrapper()
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << "CardWrapper destructor called. First stop check, then closing card.";
   graceful_stop();
   close_card();
+  // Only once the card can't write to them any more
+  if (m_dma_allocator != nullptr) {
+    release_DMA_buffers();
+  }
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << "CardWrapper destroyed.";
 }
 
 void
 CardWrapper::init(const data_t& /*args*/)
 {
-  m_flx_card = std::make_unique<FlxCard>();
-  if (m_flx_card == nullptr) {
-    ers::fatal(flxlibs::CardError(ERS_HERE, "Couldn't create FlxCard object."));
-  }
+  // The card backend is selected by the configuration, it is created on configure.
 }
 
 void
@@ -74,18 +91,79 @@ CardWrapper::configure(const data_t& args)
   if (m_configured) {
     TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << "Card is already configured! Won't touch it.";
   } else {
-    // Load config
+    std::lock_guard<std::mutex> config_lock(m_config_mutex);
+    auto t0 = std::chrono::steady_clock::now();
+    // Load config, the buffers of a previous configuration are only reused from the same allocator
+    auto previous_cfg = m_cfg;
     m_cfg = args.get<felixcardreader::Conf>();
+    if (m_dma_allocator != nullptr &&
+        (m_cfg.dma_allocator != previous_cfg.dma_allocator || m_cfg.card_backend != previous_cfg.card_backend ||
+         m_cfg.numa_id != previous_cfg.numa_id)) {
+      release_DMA_buffers();
+      m_dma_allocator.reset();
+    }
     m_card_id = m_cfg.card_id;
     m_logical_unit = m_cfg.logical_unit;
-    m_dma_id = m_cfg.dma_id;
     m_margin_blocks = m_cfg.dma_margin_blocks;
-    m_block_threshold = m_cfg.dma_block_threshold;
-    m_interrupt_mode = m_cfg.interrupt_mode;
+    m_block_threshold = std::max<size_t>(m_cfg.dma_block_threshold, 1);
+    m_flush_timeout = std::chrono::microseconds(m_cfg.dma_flush_timeout);
+    m_drain_timeout = std::chrono::milliseconds(m_cfg.drain_timeout);
+    m_lease_timeout = std::chrono::milliseconds(m_cfg.lease_timeout);
+    m_reset_on_stop = m_cfg.reset_on_stop;
+    m_adaptive_threshold = m_cfg.dma_adaptive_threshold && m_flush_timeout.count() > 0;
+    m_interrupt_mode = m_cfg.interrupt_mode && !m_cfg.hybrid_mode;
+    m_hybrid_mode = m_cfg.hybrid_mode;
+    m_hybrid_high_water_blocks = m_cfg.hybrid_high_water_blocks;
+    m_hybrid_poll_timeout = std::chrono::microseconds(m_cfg.hybrid_poll_timeout);
     m_poll_time = m_cfg.poll_time;
     m_dma_memory_size = m_cfg.dma_memory_size_gb * 1024 * 1024 * 1024UL;
     m_numa_id = m_cfg.numa_id;
-    m_dma_processor.set_name(m_dma_processor_name, m_card_id);
+    if (m_interrupt_mode && m_cfg.irq_dispatcher_threads > 0) { // not in hybrid mode
+      std::vector<int> dispatcher_cpus(m_cfg.dma_cpus.begin(), m_cfg.dma_cpus.end());
+      if (dispatcher_cpus.empty()) {
+        dispatcher_cpus = numa_node_cpus(m_numa_id);
+      }
+      m_irq_dispatcher = InterruptDispatcher::shared(m_cfg.irq_dispatcher_threads, dispatcher_cpus);
+    }
+
+    // One channel per DMA descriptor, or the single dma_id if none are listed
+    std::vector<int> dma_ids;
+    for (const auto& descriptor : m_cfg.dma_descriptors) {
+      dma_ids.push_back(descriptor.dma_id);
+    }
+    if (dma_ids.empty()) {
+      dma_ids.push_back(m_cfg.dma_id);
+    }
+    for (auto dma_id : dma_ids) {
+      auto dma = std::make_unique<DMAChannel>(dma_id);
+      dma->processor.set_name(m_dma_processor_name + "-" + std::to_string(m_card_id), dma_id);
+      dma->poll_backoff.configure(m_cfg.poll_spin_count, m_cfg.poll_yield_count, m_cfg.poll_min_sleep, m_poll_time);
+      dma->cpus = thread_cpus(m_cfg.dma_cpus, m_numa_id, m_dma_channels.size());
+      m_dma_channels.push_back(std::move(dma));
+    }
+
+    // The DMA buffers are walked in blocks of a fixed size, the card or its emulation must write those
+    if (m_cfg.dma_block_size_kb * 1024UL != m_block_size) {
+      ers::fatal(flxlibs::BlockSizeConfigurationInconsistency(ERS_HERE, m_cfg.dma_block_size_kb * 1024));
+    }
+    {
+      // Opmon reads the card between transitions
+      auto lock = lock_card();
+      m_flx_card = createCardBackend(m_cfg);
+    }
+    if (m_flx_card == nullptr) {
+      ers::fatal(flxlibs::CardError(ERS_HERE, "Couldn't create card backend of type " + m_cfg.card_backend));
+    }
+
+    if (m_dma_allocator == nullptr) {
+      m_dma_allocator = createDmaBufferAllocator(m_cfg);
+    }
+    if (m_dma_allocator == nullptr) {
+      ers::fatal(flxlibs::ConfigurationError(ERS_HERE, "Unknown DMA buffer allocator " + m_cfg.dma_allocator));
+    } else if (m_dma_allocator->virtual_dma_addresses() != m_flx_card->virtual_dma_addresses()) {
+      ers::fatal(flxlibs::ConfigurationError(ERS_HERE, "DMA buffer allocator " + m_dma_allocator->name() +
+                                                         " doesn't fit card backend " + m_cfg.card_backend));
+    }
 
     std::ostringstream cardoss;
     cardoss << "[id:" << std::to_string(m_card_id) << " slr:" << std::to_string(m_logical_unit) << "]";
@@ -95,32 +173,155 @@ CardWrapper::configure(const data_t& args)
     open_card();
     TLOG_DEBUG(TLVL_WORK_STEPS) << "Card[" << m_card_id_str << "] opened.";
     // Allocate CMEM
-    m_cmem_handle = allocate_CMEM(m_numa_id, m_dma_memory_size, &m_phys_addr, &m_virt_addr);
-    TLOG_DEBUG(TLVL_WORK_STEPS) << "Card[" << m_card_id_str << "] CMEM memory allocated with "
-                                << std::to_string(m_dma_memory_size) << " Bytes.";
+    reclaim_leased_buffers();
+    for (auto& dma : m_dma_channels) {
+      TLOG_DEBUG(TLVL_WORK_STEPS) << "Allocating " << m_dma_allocator->name() << " buffer " << m_card_id_str
+                                  << " dma id:" << std::to_string(dma->dma_id);
+      allocate_DMA_buffer(*dma);
+      if (m_cfg.zero_copy_chunks) {
+        dma->leases = std::make_unique<DmaLeaseTable>(dma->virt_addr, m_dma_memory_size, m_block_size);
+      }
+      TLOG_DEBUG(TLVL_WORK_STEPS) << "Card[" << m_card_id_str << "] dma id:" << std::to_string(dma->dma_id)
+                                  << " buffer on NUMA node " << dma->buffer.numa_node << " with "
+                                  << dma->buffer.page_size / 1024 << " kB pages.";
+    }
+    // Spare buffers of a previous configuration that didn't fit
+    for (auto& buffer : m_spare_dma_buffers) {
+      m_dma_allocator->release(buffer);
+    }
+    m_spare_dma_buffers.clear();
+    TLOG_DEBUG(TLVL_WORK_STEPS) << "Card[" << m_card_id_str << "] " << m_dma_allocator->name()
+                                << " memory allocated with " << std::to_string(m_dma_memory_size)
+                                << " Bytes for each of " << m_dma_channels.size() << " DMA descriptors.";
     // Stop currently running DMA
     stop_DMA();
     TLOG_DEBUG(TLVL_WORK_STEPS) << "Card[" << m_card_id_str << "] DMA interactions force stopped.";
     // Init DMA between software and card
     init_DMA();
     TLOG_DEBUG(TLVL_WORK_STEPS) << "Card[" << m_card_id_str << "] DMA access initialized.";
-    // The rest was some CPU pinning.
-    TLOG_DEBUG(TLVL_WORK_STEPS) << m_card_id_str << "] is configured for datataking.";
+    // CPU pinning: the DMA threads pin themselves when they start processing
+    for (auto& dma : m_dma_channels) {
+      TLOG_DEBUG(TLVL_WORK_STEPS) << "Card[" << m_card_id_str << "] dma id:" << std::to_string(dma->dma_id)
+                                  << " processor runs on CPUs " << cpus_to_string(dma->cpus);
+    }
+    TLOG_DEBUG(TLVL_WORK_STEPS) << m_card_id_str << "] is configured for datataking in "
+                                << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count()
+                                << " ms.";
     m_configured = true;
   }
 }
 
+void
+CardWrapper::scrap(const data_t& /*args*/)
+{
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << "Scrapping CardWrapper of card " << m_card_id_str << "...";
+  if (!m_configured) {
+    TLOG_DEBUG(TLVL_WORK_STEPS) << "CardWrapper of card " << m_card_id_str << " is not configured!";
+    return;
+  }
+  std::lock_guard<std::mutex> config_lock(m_config_mutex);
+  graceful_stop();
+  close_card();
+  // Allocating and prefaulting GiBs of DMA memory takes seconds, keep the buffers for the next configure.
+  // Chunks still leased downstream point into their buffer and lease table: those are set aside
+  // until their last lease is dropped, so that no configure hands the buffer to the card again.
+  wait_for_leases(std::chrono::steady_clock::now() + m_lease_timeout);
+  for (auto& dma : m_dma_channels) {
+    if (dma->leases != nullptr && dma->leases->outstanding() != 0) {
+      ers::warning(flxlibs::CardError(ERS_HERE,
+                                      "DMA " + std::to_string(dma->dma_id) + " still has " +
+                                        std::to_string(dma->leases->outstanding()) +
+                                        " leased blocks at scrap, its buffer isn't reused until they are dropped."));
+      dma->leases->deregister();
+      m_leased_dma_buffers.push_back({ dma->buffer, std::move(dma->leases) });
+    } else {
+      m_spare_dma_buffers.push_back(dma->buffer);
+    }
+    dma->buffer = DmaBuffer();
+  }
+  m_dma_channels.clear();
+  m_dma_block_span_handlers.clear();
+  m_irq_dispatcher.reset();
+  {
+    auto lock = lock_card();
+    m_flx_card.reset();
+  }
+  m_configured = false;
+  TLOG_DEBUG(TLVL_WORK_STEPS) << "Scrapped CardWrapper of card " << m_card_id_str << ", kept "
+                              << m_spare_dma_buffers.size() << " DMA buffers.";
+}
+
 void
 CardWrapper::start(const data_t& /*args*/)
 {
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << "Starting CardWrapper of card " << m_card_id_str << "...";
   if (!m_run_marker.load()) {
-    if (!m_block_addr_handler_available) {
+    if (!m_block_addr_handler_available && !m_block_span_handler_available && m_dma_block_span_handlers.empty()) {
       TLOG() << "Block Address handler is not set! Is it intentional?";
     }
+    for (auto& dma : m_dma_channels) {
+      if (m_dma_block_span_handlers.count(dma->dma_id) != 0) {
+        dma->handle_block_span = m_dma_block_span_handlers[dma->dma_id];
+      } else if (m_block_span_handler_available) {
+        dma->handle_block_span = m_handle_block_span;
+      } else {
+        dma->handle_block_span = nullptr;
+      }
+    }
+    for (auto& dma : m_dma_channels) {
+      dma->polling.store(false);
+      dma->mode_since_ns.store(std::chrono::steady_clock::now().time_since_epoch().count());
+      dma->block_threshold.store(m_block_threshold);
+      dma->arrival_rate.store(0.);
+      dma->last_batch = std::chrono::steady_clock::now();
+      dma->held_back = false;
+    }
+    // The card restarts at the beginning of the buffers, over blocks that may still be leased
+    if (!wait_for_leases(std::chrono::steady_clock::now() + m_lease_timeout)) {
+      ers::warning(flxlibs::CardError(ERS_HERE, "Blocks are still leased downstream, the card may overwrite them."));
+    }
     start_DMA();
     set_running(true);
-    m_dma_processor.set_work(&CardWrapper::process_DMA, this);
+    for (auto& dma : m_dma_channels) {
+      if (m_irq_dispatcher != nullptr) {
+        int irq_fd = m_flx_card->interrupt_fd(data_available_irq(*dma));
+        if (irq_fd >= 0) {
+          DMAChannel* channel = dma.get();
+          dma->irq_source = m_irq_dispatcher->add_source(irq_fd, [this, channel]() { service_DMA(*channel); });
+          auto kick_irq = [irq_fd]() {
+            uint64_t one = 1; // NOLINT(build/unsigned)
+            [[maybe_unused]] auto ret = write(irq_fd, &one, sizeof(one));
+          };
+          if (dma->leases != nullptr) {
+            // Releases of held blocks kick the dispatcher like an interrupt
+            dma->leases->set_wakeup(kick_irq);
+          }
+          if (m_flush_timeout.count() > 0) {
+            // Blocks below the threshold are handed out at their flush deadline, also without
+            // further interrupts. The timer kicks the interrupt, so service_DMA never runs twice at once.
+            dma->flush_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+            if (dma->flush_timer_fd >= 0) {
+              dma->flush_timer_source = m_irq_dispatcher->add_source(dma->flush_timer_fd, kick_irq);
+            }
+            if (dma->flush_timer_source < 0) {
+              ers::error(flxlibs::CardError(ERS_HERE, "No flush timer for DMA " + std::to_string(dma->dma_id) +
+                                                        ", its flush timeout is checked on interrupts only."));
+              close_flush_timer(*dma);
+            }
+          }
+          // Blocks that arrived before the source was added didn't raise an interrupt, kick it once
+          kick_irq();
+        }
+        if (dma->irq_source >= 0) {
+          continue;
+        }
+        ers::error(flxlibs::CardError(ERS_HERE, "No interrupt file descriptor for DMA " + std::to_string(dma->dma_id) +
+                                                  ", waiting for its interrupts in a dedicated thread."));
+      }
+      if (!dma->completion.set_work(dma->processor, &CardWrapper::process_DMA, this, std::ref(*dma))) {
+        ers::error(flxlibs::CardError(ERS_HERE, "Processor of DMA " + std::to_string(dma->dma_id) + " is still busy."));
+      }
+    }
     TLOG_DEBUG(TLVL_WORK_STEPS) << "Started CardWrapper of card " << m_card_id_str << "...";
   } else {
     TLOG_DEBUG(TLVL_WORK_STEPS) << "CardWrapper of card " << m_card_id_str << " is already running!";
@@ -132,13 +333,48 @@ CardWrapper::graceful_stop()
 {
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << "Stopping CardWrapper of card " << m_card_id_str << "...";
   if (m_run_marker.load()) {
+    auto t0 = std::chrono::steady_clock::now();
+    bool drain = m_drain_timeout.count() > 0;
+    if (drain) { // the card stops writing first, what is in the DMA buffers is still handed out
+      stop_DMA();
+    }
     set_running(false);
-    while (!m_dma_processor.get_readiness()) {
-      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    // A DMA thread waiting for an interrupt doesn't see the stop until the card raises one,
+    // which it doesn't do once it has stopped or without traffic
+    for (auto& dma : m_dma_channels) {
+      if (dma->irq_source < 0 && (m_interrupt_mode || m_hybrid_mode)) {
+        m_flx_card->irq_cancel(data_available_irq(*dma));
+      }
     }
-    stop_DMA();
-    init_DMA();
-    TLOG_DEBUG(TLVL_WORK_STEPS) << "Stopped CardWrapper of card " << m_card_id_str << "!";
+    for (auto& dma : m_dma_channels) {
+      close_flush_timer(*dma);
+      if (dma->irq_source >= 0) {
+        m_irq_dispatcher->remove_source(dma->irq_source);
+        dma->irq_source = -1;
+      }
+      if (dma->leases != nullptr) {
+        dma->leases->set_wakeup(nullptr);
+      }
+      dma->completion.wait(dma->processor);
+    }
+    if (drain) {
+      if (!drain_DMA(t0 + m_drain_timeout)) {
+        m_drain_stats.timeout_ctr++;
+        TLOG() << "Drain of the DMA buffers of card " << m_card_id_str << " timed out after "
+               << m_drain_timeout.count() << " ms.";
+      }
+    } else {
+      stop_DMA();
+    }
+    if (m_reset_on_stop) {
+      init_DMA();
+    } else { // fast stop: no resets, the next start reuses the same buffers
+      rewind_DMA();
+    }
+    auto stop_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count();
+    m_drain_stats.stop_ns.store(stop_ns);
+    TLOG_DEBUG(TLVL_WORK_STEPS) << "Stopped CardWrapper of card " << m_card_id_str << " in " << stop_ns / 1000000.
+                                << " ms!";
   } else {
     TLOG_DEBUG(TLVL_WORK_STEPS) << "CardWrapper of card " << m_card_id_str << " is already stopped!";
   }
@@ -157,15 +393,99 @@ CardWrapper::set_running(bool should_run)
   TLOG_DEBUG(TLVL_WORK_STEPS) << "Active state was toggled from " << was_running << " to " << should_run;
 }
 
+void
+CardWrapper::get_info(opmonlib::InfoCollector& ci, int /*level*/)
+{
+  std::lock_guard<std::mutex> config_lock(m_config_mutex);
+  for (auto& dma : m_dma_channels) {
+    felixcardreaderinfo::DMAInfo info;
+    info.card_id = m_card_id;
+    info.logical_unit = m_logical_unit;
+    info.dma_id = dma->dma_id;
+    info.cpu = dma->cpu.load();
+    info.buffer_numa_node = dma->buffer.numa_node < 0 ? 255 : dma->buffer.numa_node;
+    info.buffer_page_size_kb = dma->buffer.page_size / 1024;
+    info.num_spin_wakeups = dma->stats.spin_wakeup_ctr.exchange(0);
+    info.num_yield_wakeups = dma->stats.yield_wakeup_ctr.exchange(0);
+    info.num_sleep_wakeups = dma->stats.sleep_wakeup_ctr.exchange(0);
+    info.num_interrupts = dma->stats.interrupt_ctr.exchange(0);
+    info.num_deadline_flushes = dma->stats.deadline_flush_ctr.exchange(0);
+    info.block_threshold = dma->block_threshold.load();
+    info.arrival_rate_khz = dma->arrival_rate.load() * 1000.;
+    if (m_hybrid_mode) {
+      account_mode_time(*dma);
+    }
+    info.num_switches_to_poll = dma->stats.to_poll_switch_ctr.exchange(0);
+    info.num_switches_to_interrupt = dma->stats.to_interrupt_switch_ctr.exchange(0);
+    info.interrupt_mode_time_ms = dma->stats.interrupt_mode_ns.exchange(0) / 1e6;
+    info.poll_mode_time_ms = dma->stats.poll_mode_ns.exchange(0) / 1e6;
+    info.num_address_reads = dma->stats.address_read_ctr.exchange(0);
+    info.num_set_ptr = dma->stats.set_ptr_ctr.exchange(0);
+    uint64_t set_ptr_ns = dma->stats.set_ptr_ns.exchange(0); // NOLINT(build/unsigned)
+    info.avg_set_ptr_ns = info.num_set_ptr ? static_cast<double>(set_ptr_ns) / info.num_set_ptr : 0.;
+    info.max_set_ptr_ns = dma->stats.set_ptr_max_ns.exchange(0);
+    info.num_lost_blocks = dma->stats.lost_block_ctr.exchange(0);
+    info.num_ring_full = dma->stats.ring_full_ctr.exchange(0);
+    info.num_lease_holds = dma->stats.lease_hold_ctr.exchange(0);
+    info.max_held_blocks = dma->stats.held_blocks_max.exchange(0);
+    info.num_outstanding_holds = (dma->leases != nullptr) ? dma->leases->outstanding() : 0;
+    uint64_t interval_ns = dma->stats.set_ptr_interval_ns.exchange(0); // NOLINT(build/unsigned)
+    info.avg_set_ptr_interval_us = info.num_set_ptr ? interval_ns / 1000. / info.num_set_ptr : 0.;
+    info.max_set_ptr_interval_us = dma->stats.set_ptr_interval_max_ns.exchange(0) / 1000.;
+    info.occupancy = static_cast<double>(dma->stats.occupancy_bytes.load()) / m_dma_memory_size;
+    info.peak_occupancy = static_cast<double>(dma->stats.occupancy_max_bytes.exchange(0)) / m_dma_memory_size;
+    info.wait_time_ms = dma->stats.wait_ns.exchange(0) / 1e6;
+    info.dispatch_time_ms = dma->stats.dispatch_ns.exchange(0) / 1e6;
+    info.num_batches_1 = dma->stats.batch_hist[0].exchange(0);
+    info.num_batches_2_7 = dma->stats.batch_hist[1].exchange(0);
+    info.num_batches_8_63 = dma->stats.batch_hist[2].exchange(0);
+    info.num_batches_64_511 = dma->stats.batch_hist[3].exchange(0);
+    info.num_batches_512_up = dma->stats.batch_hist[4].exchange(0);
+
+    opmonlib::InfoCollector child_ci;
+    child_ci.add(info);
+    ci.add("dma_" + std::to_string(m_card_id) + "_" + std::to_string(m_logical_unit) + "_" +
+             std::to_string(dma->dma_id),
+           child_ci);
+  }
+
+  felixcardreaderinfo::CardLockInfo lock_info;
+  lock_info.card_id = m_card_id;
+  lock_info.logical_unit = m_logical_unit;
+  lock_info.num_lock_acquisitions = m_card_lock_stats.lock_ctr.exchange(0);
+  lock_info.num_lock_contended = m_card_lock_stats.contended_ctr.exchange(0);
+  uint64_t wait_ns = m_card_lock_stats.wait_ns.exchange(0); // NOLINT(build/unsigned)
+  lock_info.avg_lock_wait_us =
+    lock_info.num_lock_contended ? static_cast<double>(wait_ns) / lock_info.num_lock_contended / 1000. : 0.;
+  lock_info.max_lock_wait_us = m_card_lock_stats.wait_max_ns.exchange(0) / 1000.;
+  opmonlib::InfoCollector lock_ci;
+  lock_ci.add(lock_info);
+  ci.add("card_lock_" + std::to_string(m_card_id) + "_" + std::to_string(m_logical_unit), lock_ci);
+
+  felixcardreaderinfo::CardInfo card_info;
+  card_info.card_id = m_card_id;
+  card_info.logical_unit = m_logical_unit;
+  {
+    // No backend before configure and after scrap
+    auto lock = lock_card();
+    card_info.tohost_busy = (m_flx_card != nullptr) && m_flx_card->tohost_busy_latched();
+  }
+  card_info.num_blocks_drained = m_drain_stats.drained_block_ctr.exchange(0);
+  card_info.num_drain_timeouts = m_drain_stats.timeout_ctr.exchange(0);
+  card_info.last_stop_time_ms = m_drain_stats.stop_ns.load() / 1e6;
+  opmonlib::InfoCollector card_ci;
+  card_ci.add(card_info);
+  ci.add("card_" + std::to_string(m_card_id) + "_" + std::to_string(m_logical_unit), card_ci);
+}
+
 void
 CardWrapper::open_card()
 {
   TLOG_DEBUG(TLVL_WORK_STEPS) << "Opening FELIX card " << m_card_id_str;
   try {
-    m_card_mutex.lock();
+    auto lock = lock_card();
     auto absolute_card_id = m_card_id + m_logical_unit;
-    m_flx_card->card_open(static_cast<int>(absolute_card_id), LOCK_NONE); // FlxCard.h
-    m_card_mutex.unlock();
+    m_flx_card->card_open(static_cast<int>(absolute_card_id));
   } catch (FlxException& ex) {
     ers::error(flxlibs::CardError(ERS_HERE, ex.what()));
     exit(EXIT_FAILURE);
@@ -175,52 +495,96 @@ CardWrapper::open_card()
 void
 CardWrapper::close_card()
 {
+  if (m_flx_card == nullptr) {
+    return;
+  }
   TLOG_DEBUG(TLVL_WORK_STEPS) << "Closing FELIX card " << m_card_id_str;
   try {
-    m_card_mutex.lock();
+    auto lock = lock_card();
     m_flx_card->card_close();
-    m_card_mutex.unlock();
   } catch (FlxException& ex) {
     ers::error(flxlibs::CardError(ERS_HERE, ex.what()));
     exit(EXIT_FAILURE);
   }
 }
 
-int
-CardWrapper::allocate_CMEM(uint8_t numa, u_long bsize, u_long* paddr, u_long* vaddr) // NOLINT
+void
+CardWrapper::allocate_DMA_buffer(DMAChannel& dma)
 {
-  TLOG_DEBUG(TLVL_WORK_STEPS) << "Allocating CMEM buffer " << m_card_id_str << " dma id:" << std::to_string(m_dma_id);
-  int handle;
-  unsigned ret = CMEM_Open(); // cmem_rcc.h
-  if (!ret) {
-    ret = CMEM_NumaSegmentAllocate(bsize, numa, const_cast<char*>("FelixRO"), &handle); // NUMA aware
-    // ret = CMEM_GFPBPASegmentAllocate(bsize, const_cast<char*>("FelixRO"), &handle); // non NUMA aware
-  }
-  if (!ret) {
-    ret = CMEM_SegmentPhysicalAddress(handle, paddr);
-  }
-  if (!ret) {
-    ret = CMEM_SegmentVirtualAddress(handle, vaddr);
-  }
-  if (ret) {
-    // rcc_error_print(stdout, ret);
-    m_card_mutex.lock();
-    m_flx_card->card_close();
-    m_card_mutex.unlock();
+  auto spare = std::find_if(m_spare_dma_buffers.begin(), m_spare_dma_buffers.end(),
+                            [this](const DmaBuffer& buffer) { return buffer.size == m_dma_memory_size; });
+  if (spare != m_spare_dma_buffers.end()) {
+    TLOG_DEBUG(TLVL_WORK_STEPS) << "Reusing the " << m_dma_allocator->name() << " buffer of the previous configuration";
+    dma.buffer = *spare;
+    m_spare_dma_buffers.erase(spare);
+  } else if (!m_dma_allocator->allocate(m_numa_id, m_dma_memory_size, dma.buffer)) {
+    {
+      auto lock = lock_card();
+      m_flx_card->card_close();
+    }
     ers::fatal(
       flxlibs::CardError(ERS_HERE,
-                         "Not enough CMEM memory allocated or the application demands too much CMEM memory.\n"
-                         "Fix the CMEM memory reservation in the driver or change the module's configuration."));
+                         "Not enough " + m_dma_allocator->name() +
+                           " memory or the application demands too much DMA buffer memory.\n"
+                           "Fix the CMEM or huge page reservation or change the module's configuration."));
     exit(EXIT_FAILURE);
   }
-  return handle;
+  dma.phys_addr = dma.buffer.paddr;
+  dma.virt_addr = dma.buffer.vaddr;
+  if (dma.buffer.numa_node != m_numa_id) {
+    TLOG() << "DMA buffer of card " << m_card_id_str << " dma id:" << std::to_string(dma.dma_id)
+           << " is on NUMA node " << dma.buffer.numa_node << " instead of " << std::to_string(m_numa_id);
+  }
+}
+
+void
+CardWrapper::release_DMA_buffers()
+{
+  reclaim_leased_buffers();
+  // Buffers with chunks still leased downstream are leaked with their lease table rather than freed under them
+  size_t leaked = m_leased_dma_buffers.size();
+  for (auto& leased : m_leased_dma_buffers) {
+    [[maybe_unused]] auto* kept = leased.leases.release();
+  }
+  m_leased_dma_buffers.clear();
+  for (auto& dma : m_dma_channels) {
+    if (dma->leases != nullptr && dma->leases->outstanding() != 0) {
+      dma->leases->deregister();
+      [[maybe_unused]] auto* kept = dma->leases.release();
+      ++leaked;
+    } else {
+      m_dma_allocator->release(dma->buffer);
+    }
+  }
+  for (auto& buffer : m_spare_dma_buffers) {
+    m_dma_allocator->release(buffer);
+  }
+  m_spare_dma_buffers.clear();
+  if (leaked != 0) {
+    ers::warning(flxlibs::CardError(ERS_HERE,
+                                    std::to_string(leaked) + " DMA buffers still have leased blocks, leaking them."));
+  }
+}
+
+void
+CardWrapper::reclaim_leased_buffers()
+{
+  for (auto it = m_leased_dma_buffers.begin(); it != m_leased_dma_buffers.end();) {
+    if (it->leases->outstanding() == 0) {
+      TLOG_DEBUG(TLVL_WORK_STEPS) << "Leases on a scrapped DMA buffer are dropped, keeping it as a spare";
+      m_spare_dma_buffers.push_back(it->buffer);
+      it = m_leased_dma_buffers.erase(it);
+    } else {
+      ++it;
+    }
+  }
 }
 
 void
 CardWrapper::init_DMA()
 {
   TLOG_DEBUG(TLVL_WORK_STEPS) << "InitDMA issued...";
-  m_card_mutex.lock();
+  auto lock = lock_card();
   m_flx_card->dma_reset();
   TLOG_DEBUG(TLVL_WORK_STEPS) << "flxCard.dma_reset issued.";
   m_flx_card->soft_reset();
@@ -228,68 +592,259 @@ CardWrapper::init_DMA()
   m_flx_card->irq_reset_counters();
   TLOG_DEBUG(TLVL_WORK_STEPS) << "flxCard.irq_reset_counters issued.";
   // interrupted or polled DMA processing
-  if (m_interrupt_mode) {
-#if REGMAP_VERSION < 0x500
-    m_flx_card->irq_enable(IRQ_DATA_AVAILABLE);
-#else
-    m_flx_card->irq_enable(IRQ_DATA_AVAILABLE + m_dma_id);
-#endif
+  if (m_interrupt_mode || m_hybrid_mode) {
+    for (auto& dma : m_dma_channels) {
+      m_flx_card->irq_enable(data_available_irq(*dma));
+    }
     TLOG_DEBUG(TLVL_WORK_STEPS) << "flxCard.irq_enable issued.";
   } else {
     m_flx_card->irq_disable();
     TLOG_DEBUG(TLVL_WORK_STEPS) << "flxCard.irq_disable issued.";
   }
-  m_card_mutex.unlock();
-  m_current_addr = m_phys_addr;
-  m_destination = m_phys_addr;
-  m_read_index = 0;
+  lock.unlock();
+  rewind_DMA();
   TLOG_DEBUG(TLVL_WORK_STEPS) << "flxCard initDMA done card[" << m_card_id_str << "]";
 }
 
+void
+CardWrapper::rewind_DMA()
+{
+  // dma_to_host restarts a stopped descriptor at the start of its buffer
+  for (auto& dma : m_dma_channels) {
+    dma->current_addr = dma->phys_addr;
+    dma->destination = dma->phys_addr;
+    dma->read_index = 0;
+    dma->last_set_ptr = std::chrono::steady_clock::time_point();
+  }
+}
+
 void
 CardWrapper::start_DMA()
 {
-  TLOG_DEBUG(TLVL_WORK_STEPS) << "Issuing flxCard.dma_to_host for card " << m_card_id_str
-                              << " dma id:" << std::to_string(m_dma_id);
-  m_card_mutex.lock();
-  m_flx_card->dma_to_host(m_dma_id, m_phys_addr, m_dma_memory_size, m_dma_wraparound); // FlxCard.h
-  m_card_mutex.unlock();
+  for (auto& dma : m_dma_channels) {
+    TLOG_DEBUG(TLVL_WORK_STEPS) << "Issuing flxCard.dma_to_host for card " << m_card_id_str
+                                << " dma id:" << std::to_string(dma->dma_id);
+    auto lock = lock_card();
+    m_flx_card->dma_to_host(dma->dma_id, dma->phys_addr, m_dma_memory_size, m_dma_wraparound); // FlxCard.h
+  }
+}
+
+bool
+CardWrapper::drain_DMA(std::chrono::steady_clock::time_point deadline)
+{
+  // Processors are stopped, the blocks left are handed out from the calling thread
+  for (auto& dma : m_dma_channels) {
+    read_current_address(*dma);
+    while (current_address_valid(*dma) && bytes_available(*dma) > 0) {
+      if (std::chrono::steady_clock::now() >= deadline) {
+        return false;
+      }
+      m_drain_stats.drained_block_ctr += bytes_available(*dma) / m_block_size;
+      process_blocks(*dma); // reads the current address again
+    }
+  }
+  return true;
 }
 
 void
 CardWrapper::stop_DMA()
 {
-  TLOG_DEBUG(TLVL_WORK_STEPS) << "Issuing flxCard.dma_stop for card " << m_card_id_str
-                              << " dma id:" << std::to_string(m_dma_id);
-  m_card_mutex.lock();
-  m_flx_card->dma_stop(m_dma_id);
-  m_card_mutex.unlock();
+  for (auto& dma : m_dma_channels) {
+    TLOG_DEBUG(TLVL_WORK_STEPS) << "Issuing flxCard.dma_stop for card " << m_card_id_str
+                                << " dma id:" << std::to_string(dma->dma_id);
+    auto lock = lock_card();
+    m_flx_card->dma_stop(dma->dma_id);
+  }
 }
 
 inline uint64_t // NOLINT
-CardWrapper::bytes_available()
+CardWrapper::bytes_available(const DMAChannel& dma)
+{
+  return (dma.current_addr - ((dma.read_index * m_block_size) + dma.phys_addr) + m_dma_memory_size) %
+         m_dma_memory_size;
+}
+
+std::unique_lock<std::mutex>
+CardWrapper::lock_card()
+{
+  m_card_lock_stats.lock_ctr++;
+  std::unique_lock<std::mutex> lock(m_card_mutex, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    auto t0 = std::chrono::steady_clock::now();
+    lock.lock();
+    uint64_t wait_ns = std::chrono::duration_cast<std::chrono::nanoseconds>( // NOLINT(build/unsigned)
+                         std::chrono::steady_clock::now() - t0)
+                         .count();
+    m_card_lock_stats.contended_ctr++;
+    m_card_lock_stats.wait_ns += wait_ns;
+    stats::update_max(m_card_lock_stats.wait_max_ns, wait_ns);
+  }
+  return lock;
+}
+
+void
+CardWrapper::read_current_address(DMAChannel& dma)
+{
+  // Lock-free MMIO read, the register belongs to this descriptor only
+  dma.current_addr = m_flx_card->current_address(dma.dma_id);
+  dma.stats.address_read_ctr++;
+}
+
+void
+CardWrapper::set_read_pointer(DMAChannel& dma)
+{
+  // Lock-free MMIO write, timed to keep an eye on the latency of the hot path
+  auto t0 = std::chrono::steady_clock::now();
+  m_flx_card->dma_set_ptr(dma.dma_id, dma.destination);
+  uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>( // NOLINT(build/unsigned)
+                  std::chrono::steady_clock::now() - t0)
+                  .count();
+  dma.stats.set_ptr_ctr++;
+  dma.stats.set_ptr_ns += ns;
+  stats::update_max(dma.stats.set_ptr_max_ns, ns);
+  // A long interval means the card could write into the ring only up to a stale pointer
+  if (dma.last_set_ptr != std::chrono::steady_clock::time_point()) {
+    uint64_t interval_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t0 - dma.last_set_ptr) // NOLINT
+                             .count();
+    dma.stats.set_ptr_interval_ns += interval_ns;
+    stats::update_max(dma.stats.set_ptr_interval_max_ns, interval_ns);
+  }
+  dma.last_set_ptr = t0;
+}
+
+DmaLeaseTable*
+CardWrapper::get_lease_table(int dma_id) const
+{
+  for (const auto& dma : m_dma_channels) {
+    if (dma->dma_id == dma_id) {
+      return dma->leases.get();
+    }
+  }
+  return nullptr;
+}
+
+// Block index up to which the read pointer can move from from towards to. Short of to, the
+// DMA thread waits for the release of the held blocks: the wakeup is armed and the blocks
+// checked again, so a release in between isn't missed.
+u_long
+CardWrapper::held_read_index(DMAChannel& dma, u_long from, u_long to)
+{
+  u_long index = dma.leases->hold_back(from, to);
+  if (index != to) {
+    dma.leases->arm_wakeup();
+    index = dma.leases->hold_back(index, to);
+  }
+  dma.held_back = (index != to);
+  return index;
+}
+
+// Moves a held back read pointer on once blocks are released. Nothing else would move it
+// when the card filled the buffer up to it, since no data arrives then.
+void
+CardWrapper::advance_held_read_pointer(DMAChannel& dma)
+{
+  if (!dma.held_back) {
+    return;
+  }
+  const unsigned num_blocks = m_dma_memory_size / m_block_size; // NOLINT
+  u_long dest_index = (dma.destination - dma.phys_addr) / m_block_size;
+  u_long target_index = (dma.read_index + num_blocks - m_margin_blocks) % num_blocks;
+  u_long held_index = held_read_index(dma, dest_index, target_index);
+  if (held_index != dest_index) {
+    dma.destination = dma.phys_addr + held_index * m_block_size;
+    set_read_pointer(dma);
+  }
+}
+
+bool
+CardWrapper::wait_for_leases(std::chrono::steady_clock::time_point deadline)
+{
+  for (auto& dma : m_dma_channels) {
+    while (dma->leases != nullptr && dma->leases->outstanding() != 0) {
+      if (std::chrono::steady_clock::now() >= deadline) {
+        return false;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  return true;
+}
+
+unsigned
+CardWrapper::data_available_irq(const DMAChannel& dma)
+{
+#if REGMAP_VERSION < 0x500
+  return IRQ_DATA_AVAILABLE;
+#else
+  return IRQ_DATA_AVAILABLE + dma.dma_id;
+#endif // REGMAP_VERSION
+}
+
+bool
+CardWrapper::current_address_valid(const DMAChannel& dma)
 {
-  return (m_current_addr - ((m_read_index * m_block_size) + m_phys_addr) + m_dma_memory_size) % m_dma_memory_size;
+  return (dma.phys_addr <= dma.current_addr) && (dma.current_addr <= dma.phys_addr + m_dma_memory_size);
 }
 
 void
-CardWrapper::read_current_address()
+CardWrapper::count_wakeup(DMAChannel& dma)
 {
-  m_card_mutex.lock();
-  m_current_addr = m_flx_card->m_bar0->DMA_DESC_STATUS[m_dma_id].current_address;
-  m_card_mutex.unlock();
+  if (!m_interrupt_mode && dma.poll_backoff.waits() > 0) {
+    switch (dma.poll_backoff.stage()) {
+      case PollBackoff::Stage::kSpin:
+        dma.stats.spin_wakeup_ctr++;
+        break;
+      case PollBackoff::Stage::kYield:
+        dma.stats.yield_wakeup_ctr++;
+        break;
+      case PollBackoff::Stage::kSleep:
+        dma.stats.sleep_wakeup_ctr++;
+        break;
+    }
+  }
+  dma.poll_backoff.reset();
 }
 
 void
-CardWrapper::process_DMA()
+CardWrapper::account_mode_time(DMAChannel& dma)
 {
-  TLOG_DEBUG(TLVL_WORK_STEPS) << "CardWrapper starts processing blocks...";
+  int64_t now = std::chrono::steady_clock::now().time_since_epoch().count(); // NOLINT(build/unsigned)
+  int64_t since = dma.mode_since_ns.exchange(now);                           // NOLINT(build/unsigned)
+  auto& mode_ns = dma.polling.load() ? dma.stats.poll_mode_ns : dma.stats.interrupt_mode_ns;
+  mode_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::duration(now - since))
+               .count();
+}
+
+void
+CardWrapper::set_polling(DMAChannel& dma, bool polling)
+{
+  account_mode_time(dma);
+  dma.polling.store(polling);
+  dma.poll_backoff.reset();
+  if (polling) {
+    dma.stats.to_poll_switch_ctr++;
+  } else {
+    dma.stats.to_interrupt_switch_ctr++;
+  }
+  TLOG_DEBUG(TLVL_BOOKKEEPING) << "DMA " << std::to_string(dma.dma_id) << " switched to "
+                               << (polling ? "polling" : "interrupts");
+}
+
+void
+CardWrapper::process_DMA(DMAChannel& dma)
+{
+  WorkCompletion::Guard completion_guard(dma.completion);
+  TLOG_DEBUG(TLVL_WORK_STEPS) << "CardWrapper starts processing blocks of DMA " << std::to_string(dma.dma_id) << "...";
+  if (!set_current_thread_affinity(dma.cpus)) {
+    TLOG() << "Couldn't pin DMA " << std::to_string(dma.dma_id) << " processor of card " << m_card_id_str
+           << " to CPUs " << cpus_to_string(dma.cpus);
+  }
   while (m_run_marker.load()) {
 
     // First fix us poll until read address makes sense
-    while ((m_current_addr < m_phys_addr) || (m_phys_addr + m_dma_memory_size < m_current_addr)) {
+    while (!current_address_valid(dma)) {
       if (m_run_marker.load()) {
-        read_current_address();
+        read_current_address(dma);
         std::this_thread::sleep_for(std::chrono::microseconds(5000)); // fix 5ms initial poll
       } else {
         TLOG_DEBUG(TLVL_WORK_STEPS) << "Stop issued during poll! Returning...";
@@ -298,31 +853,173 @@ CardWrapper::process_DMA()
     }
 
     // Loop or wait for interrupt while there are not enough data
-    while (bytes_available() < m_block_threshold * m_block_size) {
+    auto wait_start = std::chrono::steady_clock::now();
+    const uint64_t threshold_bytes = dma.block_threshold.load(std::memory_order_relaxed) * m_block_size; // NOLINT
+    dma.pending_since = std::chrono::steady_clock::time_point();
+    while (bytes_available(dma) < threshold_bytes) {
       if (m_run_marker.load()) {
-        if (m_interrupt_mode) {
-          m_card_mutex.lock();
-#if REGMAP_VERSION < 0x500
-          m_flx_card->irq_wait(IRQ_DATA_AVAILABLE);
-#else
-          m_flx_card->irq_wait(IRQ_DATA_AVAILABLE + m_dma_id);
-#endif // REGMAP_VERSION
-          m_card_mutex.unlock();
+        // Blocks below the threshold are handed out when the oldest reaches the flush timeout.
+        // Until then poll instead of waiting for an interrupt that may never come.
+        auto max_sleep = std::chrono::microseconds::max();
+        if (m_flush_timeout.count() > 0 && bytes_available(dma) > 0) {
+          auto now = std::chrono::steady_clock::now();
+          if (dma.pending_since == std::chrono::steady_clock::time_point()) {
+            dma.pending_since = now;
+          }
+          auto age = now - dma.pending_since;
+          if (age >= m_flush_timeout) {
+            dma.stats.deadline_flush_ctr++;
+            break;
+          }
+          max_sleep = std::chrono::duration_cast<std::chrono::microseconds>(m_flush_timeout - age);
+        }
+        // A held block may keep the card from writing, then only its release lets data in
+        bool pending = max_sleep != std::chrono::microseconds::max() || dma.held_back;
+
+        if (!pending && (m_interrupt_mode || (m_hybrid_mode && !dma.polling.load(std::memory_order_relaxed)))) {
+          // Blocks until the card raises the interrupt or stop cancels the wait, never under the card lock
+          m_flx_card->irq_wait(data_available_irq(dma));
+          if (!m_run_marker.load()) {
+            TLOG_DEBUG(TLVL_WORK_STEPS) << "Stop issued during waiting for an interrupt! Returning...";
+            return;
+          }
+          dma.stats.interrupt_ctr++;
         } else { // poll mode
-          std::this_thread::sleep_for(std::chrono::microseconds(m_poll_time));
+          dma.poll_backoff.wait(max_sleep);
+          // Hybrid mode: the fill rate dropped, go back to interrupts. Checked once past spinning.
+          if (m_hybrid_mode && dma.polling.load(std::memory_order_relaxed) &&
+              dma.poll_backoff.stage() != PollBackoff::Stage::kSpin &&
+              std::chrono::steady_clock::now() - wait_start > m_hybrid_poll_timeout) {
+            set_polling(dma, false);
+          }
         }
-        read_current_address();
+        advance_held_read_pointer(dma);
+        read_current_address(dma);
       } else {
         TLOG_DEBUG(TLVL_WORK_STEPS) << "Stop issued during waiting for data! Returning...";
         return;
       }
     }
+    count_wakeup(dma);
+    dma.stats.wait_ns +=
+      std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - wait_start).count();
+
+    // Hybrid mode: many blocks piled up while waiting for the interrupt, switch to polling
+    if (m_hybrid_mode && !dma.polling.load(std::memory_order_relaxed) &&
+        bytes_available(dma) >= m_hybrid_high_water_blocks * m_block_size) {
+      set_polling(dma, true);
+    }
+
+    process_blocks(dma);
+  }
+  TLOG_DEBUG(TLVL_WORK_STEPS) << "CardWrapper processor thread of DMA " << std::to_string(dma.dma_id) << " finished.";
+}
 
-    // Set write index and start DMA advancing
-    u_long write_index = (m_current_addr - m_phys_addr) / m_block_size;
-    uint64_t bytes = 0; // NOLINT
-    while (m_read_index != write_index) {
-      uint64_t from_address = m_virt_addr + (m_read_index * m_block_size); // NOLINT
+void
+CardWrapper::service_DMA(DMAChannel& dma)
+{
+  // Called by the interrupt dispatcher for every data available interrupt. Re-arm first,
+  // so that blocks arriving while this call looks at the buffer raise a new interrupt.
+  m_flx_card->irq_ack(data_available_irq(dma));
+  dma.stats.interrupt_ctr++;
+  if (!m_run_marker.load()) {
+    return;
+  }
+  advance_held_read_pointer(dma);
+  read_current_address(dma);
+  if (!current_address_valid(dma) || bytes_available(dma) == 0) {
+    return;
+  }
+  auto now = std::chrono::steady_clock::now();
+  if (bytes_available(dma) < dma.block_threshold.load(std::memory_order_relaxed) * m_block_size) {
+    if (m_flush_timeout.count() == 0) {
+      return;
+    }
+    if (dma.pending_since == std::chrono::steady_clock::time_point()) {
+      dma.pending_since = now;
+    }
+    if (now - dma.pending_since < m_flush_timeout) {
+      arm_flush_timer(dma, dma.pending_since + m_flush_timeout - now);
+      return;
+    }
+    dma.stats.deadline_flush_ctr++;
+  }
+  dma.pending_since = std::chrono::steady_clock::time_point();
+  process_blocks(dma);
+}
+
+void
+CardWrapper::arm_flush_timer(DMAChannel& dma, std::chrono::steady_clock::duration timeout)
+{
+  if (dma.flush_timer_fd < 0) {
+    return;
+  }
+  auto ns = std::max<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count(), 1);
+  itimerspec spec{};
+  spec.it_value.tv_sec = ns / 1000000000;
+  spec.it_value.tv_nsec = ns % 1000000000;
+  timerfd_settime(dma.flush_timer_fd, 0, &spec, nullptr);
+}
+
+void
+CardWrapper::close_flush_timer(DMAChannel& dma)
+{
+  if (dma.flush_timer_source >= 0) {
+    m_irq_dispatcher->remove_source(dma.flush_timer_source);
+    dma.flush_timer_source = -1;
+  }
+  if (dma.flush_timer_fd >= 0) {
+    close(dma.flush_timer_fd);
+    dma.flush_timer_fd = -1;
+  }
+}
+
+void
+CardWrapper::update_block_threshold(DMAChannel& dma, size_t blocks)
+{
+  auto now = std::chrono::steady_clock::now();
+  double elapsed_us = std::chrono::duration<double, std::micro>(now - dma.last_batch).count();
+  dma.last_batch = now;
+  if (elapsed_us <= 0.) {
+    return;
+  }
+  // Exponential moving average of the arrival rate, then a threshold that fills in half the
+  // flush timeout: high rates keep the configured batches, low rates get a bounded latency.
+  double rate = dma.arrival_rate.load(std::memory_order_relaxed);
+  double batch_rate = blocks / elapsed_us;
+  rate = (rate == 0.) ? batch_rate : rate + (batch_rate - rate) / 8.;
+  dma.arrival_rate.store(rate, std::memory_order_relaxed);
+  size_t threshold = static_cast<size_t>(rate * m_flush_timeout.count() / 2.);
+  dma.block_threshold.store(std::clamp<size_t>(threshold, 1, m_block_threshold), std::memory_order_relaxed);
+}
+
+void
+CardWrapper::process_blocks(DMAChannel& dma)
+{
+  const unsigned num_blocks = m_dma_memory_size / m_block_size; // NOLINT
+  auto t0 = std::chrono::steady_clock::now();
+
+  // Set write index and start DMA advancing
+  u_long write_index = (dma.current_addr - dma.phys_addr) / m_block_size;
+  size_t blocks = (write_index + num_blocks - dma.read_index) % num_blocks;
+  if (m_adaptive_threshold) {
+    update_block_threshold(dma, blocks);
+  }
+  // Ring occupancy before handing out: close to 1 the card is about to overrun the read pointer
+  dma.stats.occupancy_bytes.store(blocks * m_block_size, std::memory_order_relaxed);
+  stats::update_max(dma.stats.occupancy_max_bytes, blocks * m_block_size);
+  dma.stats.batch_hist[stats::batch_hist_bucket(blocks)]++;
+  if (dma.handle_block_span) {
+    // Hand out contiguous runs of blocks, split at the wraparound
+    while (dma.read_index != write_index) {
+      unsigned span_end = (write_index > dma.read_index) ? write_index : num_blocks; // NOLINT
+      dma.stats.lost_block_ctr +=
+        dma.handle_block_span(dma.virt_addr + (dma.read_index * m_block_size), span_end - dma.read_index);
+      dma.read_index = span_end % num_blocks;
+    }
+  } else {
+    while (dma.read_index != write_index) {
+      uint64_t from_address = dma.virt_addr + (dma.read_index * m_block_size); // NOLINT
 
       // Handle block address
       if (m_block_addr_handler_available) {
@@ -330,22 +1027,38 @@ CardWrapper::process_DMA()
       }
 
       // Advance
-      m_read_index = (m_read_index + 1) % (m_dma_memory_size / m_block_size);
-      bytes += m_block_size;
+      dma.read_index = (dma.read_index + 1) % num_blocks;
     }
+  }
 
-    // here check if we can move the read pointer in the circular buffer
-    m_destination = m_phys_addr + (write_index * m_block_size) - (m_margin_blocks * m_block_size);
-    if (m_destination < m_phys_addr) {
-      m_destination += m_dma_memory_size;
-    }
+  // The card doesn't write past the read pointer of the previous dispatch. If it got there
+  // while the blocks were handed out, it stalled, and data is dropped upstream once its
+  // FIFOs run full. The address read also serves the next wait for data.
+  read_current_address(dma);
+  u_long card_index = ((dma.current_addr - dma.phys_addr) / m_block_size) % num_blocks;
+  u_long dest_index = (dma.destination - dma.phys_addr) / m_block_size;
+  if ((dest_index + num_blocks - card_index) % num_blocks <= 1) {
+    dma.stats.ring_full_ctr++;
+  }
 
-    // Finally, set new pointer
-    m_card_mutex.lock();
-    m_flx_card->dma_set_ptr(m_dma_id, m_destination);
-    m_card_mutex.unlock();
+  // here check if we can move the read pointer in the circular buffer, not past the first
+  // block still held by a parser or leased downstream
+  u_long next_dest_index = (write_index + num_blocks - m_margin_blocks) % num_blocks;
+  if (dma.leases != nullptr) {
+    u_long held_index = held_read_index(dma, dest_index, next_dest_index);
+    if (held_index != next_dest_index) {
+      dma.stats.lease_hold_ctr++;
+      stats::update_max(dma.stats.held_blocks_max, (next_dest_index + num_blocks - held_index) % num_blocks);
+    }
+    next_dest_index = held_index;
   }
-  TLOG_DEBUG(TLVL_WORK_STEPS) << "CardWrapper processor thread finished.";
+  dma.destination = dma.phys_addr + next_dest_index * m_block_size;
+
+  // Finally, set new pointer
+  set_read_pointer(dma);
+  dma.cpu.store(sched_getcpu(), std::memory_order_relaxed);
+  dma.stats.dispatch_ns +=
+    std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count();
 }
 
 } // namespace flxlibs
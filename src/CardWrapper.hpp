@@ -8,9 +8,18 @@
 #ifndef FLXLIBS_SRC_CARDWRAPPER_HPP_
 #define FLXLIBS_SRC_CARDWRAPPER_HPP_
 
+#include "CardBackend.hpp"
+#include "DmaBufferAllocator.hpp"
+#include "FelixStatistics.hpp"
+#include "InterruptDispatcher.hpp"
+#include "PollBackoff.hpp"
+#include "WorkCompletion.hpp"
+
+#include "flxlibs/DmaLeaseTable.hpp"
 #include "flxlibs/felixcardreader/Nljs.hpp"
 #include "flxlibs/felixcardreader/Structs.hpp"
 
+#include "opmonlib/InfoCollector.hpp"
 #include "readoutlibs/utils/ReusableThread.hpp"
 
 #include "flxcard/FlxCard.h"
@@ -19,9 +28,12 @@
 #include <nlohmann/json.hpp>
 
 #include <atomic>
+#include <chrono>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <vector>
 
 namespace dunedaq::flxlibs {
 
@@ -42,9 +54,11 @@ public:
   using data_t = nlohmann::json;
   void init(const data_t& args);
   void configure(const data_t& args);
+  void scrap(const data_t& args);
   void start(const data_t& args);
   void stop(const data_t& args);
   void set_running(bool should_run);
+  void get_info(opmonlib::InfoCollector& ci, int level);
 
   void graceful_stop();
 
@@ -54,10 +68,72 @@ public:
     m_block_addr_handler_available = true;
   }
 
+  // Receives (first_block_addr, count) for every contiguous run of new blocks in the
+  // DMA buffer. Runs are split at the buffer's wraparound. Takes precedence over the
+  // single block address handler. Returns the blocks found missing from the block
+  // sequence numbers, that are counted as lost on the DMA descriptor.
+  void set_block_span_handler(std::function<size_t(uint64_t, size_t)>& handle) // NOLINT(build/unsigned)
+  {                                                                            // NOLINT
+    m_handle_block_span = handle;
+    m_block_span_handler_available = true;
+  }
+
+  // Span handler for the blocks of a single DMA descriptor. Takes precedence over the
+  // handler set for all descriptors.
+  void set_block_span_handler(int dma_id, std::function<size_t(uint64_t, size_t)>& handle) // NOLINT(build/unsigned)
+  {
+    m_dma_block_span_handlers[dma_id] = handle;
+  }
+
+  static constexpr size_t get_block_size() { return m_block_size; }
+
+  // Holds on the blocks of the DMA buffer of a descriptor, nullptr unless zero_copy_chunks
+  // is set. The read pointer doesn't move past held blocks.
+  DmaLeaseTable* get_lease_table(int dma_id) const;
+
 private:
   // Types
   using module_conf_t = dunedaq::flxlibs::felixcardreader::Conf;
 
+  // Per DMA descriptor state: DMA buffer, read thread and dma_set_ptr bookkeeping
+  struct DMAChannel
+  {
+    explicit DMAChannel(uint8_t id) // NOLINT(build/unsigned)
+      : dma_id(id)
+      , processor(0)
+    {}
+
+    uint8_t dma_id;             // NOLINT(build/unsigned)
+    DmaBuffer buffer;           // the DMA memory block and its placement
+    uint64_t virt_addr{ 0 };    // NOLINT virtual address of the DMA memory block
+    uint64_t phys_addr{ 0 };    // NOLINT physical address of the DMA memory block
+    uint64_t current_addr{ 0 }; // NOLINT pointer to the current write position for the card
+    unsigned read_index{ 0 };   // NOLINT
+    u_long destination{ 0 };    // u_long -> FlxCard.h
+    PollBackoff poll_backoff;
+    stats::DMAStats stats;
+    std::function<size_t(uint64_t, size_t)> handle_block_span; // NOLINT
+    readoutlibs::ReusableThread processor;
+    WorkCompletion completion; // of process_DMA
+    InterruptDispatcher::source_id_t irq_source{ -1 };
+    int flush_timer_fd{ -1 }; // interrupt dispatcher: fires at the flush deadline of pending blocks
+    InterruptDispatcher::source_id_t flush_timer_source{ -1 };
+    std::vector<int> cpus;      // affinity of the processor thread
+    std::atomic<int> cpu{ -1 }; // CPU the blocks were last processed on
+    // Hybrid mode: current wait mode and when it was last accounted
+    std::atomic<bool> polling{ false };
+    std::atomic<int64_t> mode_since_ns{ 0 }; // NOLINT(build/unsigned)
+    // Batching: adaptive block threshold from the arrival rate, and age of the waiting blocks
+    std::atomic<size_t> block_threshold{ 0 };
+    std::atomic<double> arrival_rate{ 0. }; // blocks per us
+    std::chrono::steady_clock::time_point last_batch;
+    std::chrono::steady_clock::time_point pending_since;
+    std::chrono::steady_clock::time_point last_set_ptr;
+    std::unique_ptr<DmaLeaseTable> leases;
+    bool held_back{ false }; // the read pointer stops short of held blocks, DMA thread only
+  };
+  using UniqueDMAChannel = std::unique_ptr<DMAChannel>;
+
   // Constants
   static constexpr size_t m_max_links_per_card = 6;
   // static constexpr size_t m_margin_blocks = 4;
@@ -70,12 +146,22 @@ private:
   void close_card();
 
   // DMA
-  int allocate_CMEM(uint8_t numa, u_long bsize, u_long* paddr, u_long* vaddr); // NOLINT
+  void allocate_DMA_buffer(DMAChannel& dma);
+  void release_DMA_buffers();
+  void reclaim_leased_buffers();
   void init_DMA();
+  void rewind_DMA();
   void start_DMA();
   void stop_DMA();
-  uint64_t bytes_available(); // NOLINT
-  void read_current_address();
+  bool drain_DMA(std::chrono::steady_clock::time_point deadline);
+  uint64_t bytes_available(const DMAChannel& dma); // NOLINT
+  bool current_address_valid(const DMAChannel& dma);
+  void read_current_address(DMAChannel& dma);
+  void set_read_pointer(DMAChannel& dma);
+  bool wait_for_leases(std::chrono::steady_clock::time_point deadline);
+  u_long held_read_index(DMAChannel& dma, u_long from, u_long to);
+  void advance_held_read_pointer(DMAChannel& dma);
+  unsigned data_available_irq(const DMAChannel& dma);
 
   // Configuration and internals
   module_conf_t m_cfg;
@@ -84,36 +170,69 @@ private:
   uint8_t m_card_id;      // NOLINT
   uint8_t m_logical_unit; // NOLINT
   std::string m_card_id_str;
-  uint8_t m_dma_id;         // NOLINT
   size_t m_margin_blocks;   // NOLINT
   size_t m_block_threshold; // NOLINT
+  std::chrono::microseconds m_flush_timeout; // NOLINT
+  std::chrono::milliseconds m_drain_timeout; // NOLINT
+  std::chrono::milliseconds m_lease_timeout; // NOLINT
+  bool m_reset_on_stop;                      // NOLINT
+  bool m_adaptive_threshold;                 // NOLINT
   bool m_interrupt_mode;    // NOLINT
+  bool m_hybrid_mode;       // NOLINT
+  size_t m_hybrid_high_water_blocks;              // NOLINT
+  std::chrono::microseconds m_hybrid_poll_timeout; // NOLINT
   size_t m_poll_time;       // NOLINT
   uint8_t m_numa_id;        // NOLINT
   std::vector<unsigned int> m_links_enabled;      // NOLINT
   std::string m_info_str;
 
   // Card object
-  using UniqueFlxCard = std::unique_ptr<FlxCard>;
-  UniqueFlxCard m_flx_card;
+  using UniqueCardBackend = std::unique_ptr<CardBackend>;
+  UniqueCardBackend m_flx_card;
+  // Serialises control operations only, pointer accesses and irq_wait don't take it
   std::mutex m_card_mutex;
+  stats::CardLockStats m_card_lock_stats;
+  std::unique_lock<std::mutex> lock_card();
 
   // DMA: CMEM
-  std::size_t m_dma_memory_size; // size of CMEM (driver) memory to allocate
-  int m_cmem_handle;             // handle to the DMA memory block
-  uint64_t m_virt_addr;          // NOLINT virtual address of the DMA memory block
-  uint64_t m_phys_addr;          // NOLINT physical address of the DMA memory block
-  uint64_t m_current_addr;       // NOLINT pointer to the current write position for the card
-  unsigned m_read_index;         // NOLINT
-  u_long m_destination;          // u_long -> FlxCard.h
+  std::size_t m_dma_memory_size; // size of CMEM (driver) memory to allocate per DMA descriptor
+  std::unique_ptr<DmaBufferAllocator> m_dma_allocator;
+  std::vector<UniqueDMAChannel> m_dma_channels;
+  // Held by configure and scrap while they change the channels, and by get_info
+  std::mutex m_config_mutex;
+  // Buffers kept on scrap, reused by the next configure if size and NUMA node match
+  std::vector<DmaBuffer> m_spare_dma_buffers;
+  // Buffers scrapped with chunks still leased downstream, spares once their last lease is dropped
+  struct LeasedBuffer
+  {
+    DmaBuffer buffer;
+    std::unique_ptr<DmaLeaseTable> leases;
+  };
+  std::vector<LeasedBuffer> m_leased_dma_buffers;
 
   // Processor
   inline static const std::string m_dma_processor_name = "flx-dma";
   std::atomic<bool> m_run_lock;
-  readoutlibs::ReusableThread m_dma_processor;
   std::function<void(uint64_t)> m_handle_block_addr; // NOLINT
   bool m_block_addr_handler_available{ false };
-  void process_DMA();
+  std::function<size_t(uint64_t, size_t)> m_handle_block_span; // NOLINT
+  bool m_block_span_handler_available{ false };
+  std::map<int, std::function<size_t(uint64_t, size_t)>> m_dma_block_span_handlers; // NOLINT
+  void process_DMA(DMAChannel& dma);
+  void service_DMA(DMAChannel& dma);
+  void arm_flush_timer(DMAChannel& dma, std::chrono::steady_clock::duration timeout);
+  void close_flush_timer(DMAChannel& dma);
+  void process_blocks(DMAChannel& dma);
+  void update_block_threshold(DMAChannel& dma, size_t blocks);
+  void count_wakeup(DMAChannel& dma);
+  void set_polling(DMAChannel& dma, bool polling);
+  void account_mode_time(DMAChannel& dma);
+
+  // End of run: blocks handed out after the card stopped, and stop duration
+  stats::DrainStats m_drain_stats;
+
+  // Interrupt dispatcher shared with the other card readers, if configured
+  std::shared_ptr<InterruptDispatcher> m_irq_dispatcher;
 };
 
 } // namespace dunedaq::flxlibs
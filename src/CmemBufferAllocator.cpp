@@ -0,0 +1,78 @@
+/**
+ * @file CmemBufferAllocator.cpp DMA buffers from the CMEM_RCC driver
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+// From Module
+#include "CmemBufferAllocator.hpp"
+
+#include "cmem_rcc/cmem_rcc.h"
+
+// From STD
+#include <string>
+
+namespace dunedaq {
+namespace flxlibs {
+
+CmemBufferAllocator::CmemBufferAllocator(bool numa_aware, size_t prefault_threads)
+  : m_numa_aware(numa_aware)
+  , m_prefault_threads(prefault_threads)
+{}
+
+CmemBufferAllocator::~CmemBufferAllocator()
+{
+  if (m_open) {
+    CMEM_Close(); // cmem_rcc.h
+  }
+}
+
+bool
+CmemBufferAllocator::allocate(uint8_t numa, size_t size, DmaBuffer& buffer) // NOLINT(build/unsigned)
+{
+  unsigned ret = 0;
+  if (!m_open) {
+    ret = CMEM_Open();
+    m_open = (ret == 0);
+  }
+  if (!ret) {
+    if (m_numa_aware) {
+      ret = CMEM_NumaSegmentAllocate(size, numa, const_cast<char*>("FelixRO"), &buffer.handle); // NOLINT
+    } else {
+      ret = CMEM_GFPBPASegmentAllocate(size, const_cast<char*>("FelixRO"), &buffer.handle); // NOLINT
+    }
+  }
+  if (!ret) {
+    ret = CMEM_SegmentPhysicalAddress(buffer.handle, &buffer.paddr);
+  }
+  if (!ret) {
+    ret = CMEM_SegmentVirtualAddress(buffer.handle, &buffer.vaddr);
+  }
+  if (ret) {
+    return false;
+  }
+  buffer.size = size;
+  // The segment is a PFN mapping, so its node comes from the physical address
+  buffer.numa_node = query_physical_numa_node(buffer.paddr);
+  buffer.page_size = query_page_size(reinterpret_cast<void*>(buffer.vaddr)); // NOLINT
+  prefault(reinterpret_cast<void*>(buffer.vaddr), size, buffer.page_size, m_prefault_threads); // NOLINT
+  return true;
+}
+
+void
+CmemBufferAllocator::release(DmaBuffer& buffer)
+{
+  if (buffer.handle < 0) {
+    return;
+  }
+  if (m_numa_aware) {
+    CMEM_NumaSegmentFree(buffer.handle);
+  } else {
+    CMEM_GFPBPASegmentFree(buffer.handle);
+  }
+  buffer = DmaBuffer();
+}
+
+} // namespace flxlibs
+} // namespace dunedaq
@@ -0,0 +1,40 @@
+/**
+ * @file CmemBufferAllocator.hpp DMA buffers from the CMEM_RCC driver
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef FLXLIBS_SRC_CMEMBUFFERALLOCATOR_HPP_
+#define FLXLIBS_SRC_CMEMBUFFERALLOCATOR_HPP_
+
+#include "DmaBufferAllocator.hpp"
+
+#include <string>
+
+namespace dunedaq::flxlibs {
+
+/**
+ * @brief Physically contiguous DMA buffers from CMEM, either NUMA aware from the
+ * node's pool, or from the GFPBPA pool on whatever node it was reserved.
+ */
+class CmemBufferAllocator : public DmaBufferAllocator
+{
+public:
+  CmemBufferAllocator(bool numa_aware, size_t prefault_threads);
+  ~CmemBufferAllocator();
+
+  std::string name() const override { return m_numa_aware ? "cmem_numa" : "cmem_gfpbpa"; }
+  bool allocate(uint8_t numa, size_t size, DmaBuffer& buffer) override; // NOLINT(build/unsigned)
+  void release(DmaBuffer& buffer) override;
+  bool virtual_dma_addresses() const override { return false; }
+
+private:
+  bool m_numa_aware;
+  size_t m_prefault_threads;
+  bool m_open{ false };
+};
+
+} // namespace dunedaq::flxlibs
+
+#endif // FLXLIBS_SRC_CMEMBUFFERALLOCATOR_HPP_
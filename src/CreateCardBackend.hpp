@@ -0,0 +1,38 @@
+/**
+ * @file CreateCardBackend.hpp Specific CardBackend creator.
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef FLXLIBS_SRC_CREATECARDBACKEND_HPP_
+#define FLXLIBS_SRC_CREATECARDBACKEND_HPP_
+
+#include "CardBackend.hpp"
+#include "FlxCardBackend.hpp"
+#include "SoftwareCardBackend.hpp"
+
+#include "flxlibs/felixcardreader/Structs.hpp"
+
+#include <memory>
+#include <string>
+
+namespace dunedaq {
+namespace flxlibs {
+
+inline std::unique_ptr<CardBackend>
+createCardBackend(const felixcardreader::Conf& cfg)
+{
+  if (cfg.card_backend == "flx") {
+    return std::make_unique<FlxCardBackend>();
+  } else if (cfg.card_backend == "software") {
+    return std::make_unique<SoftwareCardBackend>(cfg);
+  }
+
+  return nullptr;
+}
+
+} // namespace flxlibs
+} // namespace dunedaq
+
+#endif // FLXLIBS_SRC_CREATECARDBACKEND_HPP_
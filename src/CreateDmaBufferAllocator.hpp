@@ -0,0 +1,48 @@
+/**
+ * @file CreateDmaBufferAllocator.hpp Specific DmaBufferAllocator creator.
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef FLXLIBS_SRC_CREATEDMABUFFERALLOCATOR_HPP_
+#define FLXLIBS_SRC_CREATEDMABUFFERALLOCATOR_HPP_
+
+#include "CmemBufferAllocator.hpp"
+#include "DmaBufferAllocator.hpp"
+#include "HugePageBufferAllocator.hpp"
+
+#include "flxlibs/felixcardreader/Structs.hpp"
+
+#include <memory>
+#include <string>
+
+namespace dunedaq {
+namespace flxlibs {
+
+inline std::unique_ptr<DmaBufferAllocator>
+createDmaBufferAllocator(const felixcardreader::Conf& cfg)
+{
+  // By default the card gets NUMA aware CMEM, the software backend huge pages
+  std::string type = cfg.dma_allocator;
+  if (type.empty()) {
+    type = (cfg.card_backend == "software") ? "hugepage_2m" : "cmem_numa";
+  }
+
+  if (type == "cmem_numa") {
+    return std::make_unique<CmemBufferAllocator>(true, cfg.dma_prefault_threads);
+  } else if (type == "cmem_gfpbpa") {
+    return std::make_unique<CmemBufferAllocator>(false, cfg.dma_prefault_threads);
+  } else if (type == "hugepage_2m") {
+    return std::make_unique<HugePageBufferAllocator>(2UL << 20, cfg.dma_prefault_threads);
+  } else if (type == "hugepage_1g") {
+    return std::make_unique<HugePageBufferAllocator>(1UL << 30, cfg.dma_prefault_threads);
+  }
+
+  return nullptr;
+}
+
+} // namespace flxlibs
+} // namespace dunedaq
+
+#endif // FLXLIBS_SRC_CREATEDMABUFFERALLOCATOR_HPP_
@@ -10,6 +10,7 @@
 
 #include "ElinkConcept.hpp"
 #include "ElinkModel.hpp"
+#include "PolicyParserImpl.hpp"
 #include "flxlibs/AvailableParserOperations.hpp"
 #include "fdreadoutlibs/FDReadoutTypes.hpp"
 
@@ -19,66 +20,82 @@
 namespace dunedaq {
 namespace flxlibs {
 
+// Parsers of the payload types, with their handlers inlined into the block parser
+using WIBParserImpl = PolicyParserImpl<parsers::FixsizedChunkInto<fdreadoutlibs::types::WIB_SUPERCHUNK_STRUCT>,
+                                       parsers::Discard,
+                                       parsers::Discard,
+                                       parsers::ErrorChunkIntoSink>;
+using WIB2ParserImpl = PolicyParserImpl<parsers::FixsizedChunkInto<fdreadoutlibs::types::WIB2_SUPERCHUNK_STRUCT>>;
+using PDSParserImpl = PolicyParserImpl<parsers::FixsizedChunkInto<fdreadoutlibs::types::DAPHNE_SUPERCHUNK_STRUCT>>;
+using RawTPParserImpl = PolicyParserImpl<
+  parsers::VarsizedChunkIntoWithDatafield<fdreadoutlibs::types::RAW_WIB_TRIGGERPRIMITIVE_STRUCT>>;
+using VarsizeParserImpl = PolicyParserImpl<parsers::VarsizedChunkIntoWrapper, parsers::VarsizedShortchunkIntoWrapper>;
+using LeasedParserImpl = PolicyParserImpl<parsers::LeasedChunkInto, parsers::LeasedShortchunkInto>;
+
 std::unique_ptr<ElinkConcept>
 createElinkModel(const std::string& target)
 {
-  if (target.find("wib") != std::string::npos && target.find("wib2") == std::string::npos) {
+  if (target.find("leased") != std::string::npos) {
+    // Chunks as leases on the DMA buffer, copies if they span subchunks or zero_copy_chunks is off
+    auto elink_model = std::make_unique<ElinkModel<LeasedChunk, LeasedParserImpl>>();
+    elink_model->set_sink(target);
+    auto& parser = elink_model->get_policy_parser();
+    parser.chunk_policy().sink = elink_model->get_sink();
+    parser.shortchunk_policy().sink = elink_model->get_sink();
+    return elink_model;
+
+  } else if (target.find("wib") != std::string::npos && target.find("wib2") == std::string::npos) {
     // WIB1 specific char arrays
     // Create Model
-    auto elink_model = std::make_unique<ElinkModel<fdreadoutlibs::types::WIB_SUPERCHUNK_STRUCT>>();
+    auto elink_model = std::make_unique<ElinkModel<fdreadoutlibs::types::WIB_SUPERCHUNK_STRUCT, WIBParserImpl>>();
 
     // Setup sink (acquire pointer from QueueRegistry)
     elink_model->set_sink(target);
 
     // Get parser and sink
-    auto& parser = elink_model->get_parser();
+    auto& parser = elink_model->get_policy_parser();
     auto& sink = elink_model->get_sink();
     auto& error_sink = elink_model->get_error_sink();
 
     // Modify parser as needed...
-    parser.process_chunk_func = parsers::fixsizedChunkInto<fdreadoutlibs::types::WIB_SUPERCHUNK_STRUCT>(sink);
-    if (error_sink != nullptr) {
-      parser.process_chunk_with_error_func = parsers::errorChunkIntoSink(error_sink);
-    }
-    // parser.process_block_func = ...
+    parser.chunk_policy().sink = sink;
+    parser.error_chunk_policy().sink = error_sink; // errored chunks are only counted without a sink
+    // parser.block_policy() = ...
 
     // Return with setup model
     return elink_model;
 
   } else if (target.find("wib2") != std::string::npos) {
     // WIB2 specific char arrays
-    auto elink_model = std::make_unique<ElinkModel<fdreadoutlibs::types::WIB2_SUPERCHUNK_STRUCT>>();
+    auto elink_model = std::make_unique<ElinkModel<fdreadoutlibs::types::WIB2_SUPERCHUNK_STRUCT, WIB2ParserImpl>>();
     elink_model->set_sink(target);
-    auto& parser = elink_model->get_parser();
-    auto& sink = elink_model->get_sink();
-    parser.process_chunk_func = parsers::fixsizedChunkInto<fdreadoutlibs::types::WIB2_SUPERCHUNK_STRUCT>(sink);
+    auto& parser = elink_model->get_policy_parser();
+    parser.chunk_policy().sink = elink_model->get_sink();
     return elink_model;
 
   } else if (target.find("pds") != std::string::npos) {
     // PDS specific char arrays
-    auto elink_model = std::make_unique<ElinkModel<fdreadoutlibs::types::DAPHNE_SUPERCHUNK_STRUCT>>();
+    auto elink_model = std::make_unique<ElinkModel<fdreadoutlibs::types::DAPHNE_SUPERCHUNK_STRUCT, PDSParserImpl>>();
     elink_model->set_sink(target);
-    auto& parser = elink_model->get_parser();
-    auto& sink = elink_model->get_sink();
-    parser.process_chunk_func = parsers::fixsizedChunkInto<fdreadoutlibs::types::DAPHNE_SUPERCHUNK_STRUCT>(sink);
+    auto& parser = elink_model->get_policy_parser();
+    parser.chunk_policy().sink = elink_model->get_sink();
     return elink_model;
 
   } else if (target.find("raw_tp") != std::string::npos) {
-    auto elink_model = std::make_unique<ElinkModel<fdreadoutlibs::types::RAW_WIB_TRIGGERPRIMITIVE_STRUCT>>();
+    auto elink_model =
+      std::make_unique<ElinkModel<fdreadoutlibs::types::RAW_WIB_TRIGGERPRIMITIVE_STRUCT, RawTPParserImpl>>();
     elink_model->set_sink(target);
-    auto& parser = elink_model->get_parser();
-    auto& sink = elink_model->get_sink();
-    parser.process_chunk_func = parsers::varsizedChunkIntoWithDatafield<fdreadoutlibs::types::RAW_WIB_TRIGGERPRIMITIVE_STRUCT>(sink);
+    auto& parser = elink_model->get_policy_parser();
+    parser.chunk_policy().sink = elink_model->get_sink();
     return elink_model;
 
   } else if (target.find("varsize") != std::string::npos) {
     // Variable sized user payloads
-    auto elink_model = std::make_unique<ElinkModel<fdreadoutlibs::types::VariableSizePayloadWrapper>>();
+    auto elink_model = std::make_unique<ElinkModel<fdreadoutlibs::types::VariableSizePayloadWrapper, VarsizeParserImpl>>();
     elink_model->set_sink(target);
-    auto& parser = elink_model->get_parser();
-    auto& sink = elink_model->get_sink();
-    parser.process_chunk_func = parsers::varsizedChunkIntoWrapper(sink);
-    parser.process_shortchunk_func = parsers::varsizedShortchunkIntoWrapper(sink);
+    auto& parser = elink_model->get_policy_parser();
+    parser.chunk_policy().sink = elink_model->get_sink();
+    parser.shortchunk_policy().sink = elink_model->get_sink();
     return elink_model;
   }
 
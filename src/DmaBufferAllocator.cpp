@@ -0,0 +1,107 @@
+/**
+ * @file DmaBufferAllocator.cpp Placement queries and prefaulting of DMA buffers
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+// From Module
+#include "DmaBufferAllocator.hpp"
+
+// From STD
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace dunedaq {
+namespace flxlibs {
+
+size_t
+query_page_size(const void* addr)
+{
+  auto address = reinterpret_cast<uintptr_t>(addr); // NOLINT
+  std::ifstream smaps("/proc/self/smaps");
+  std::string line;
+  bool in_mapping = false;
+  while (std::getline(smaps, line)) {
+    // Mapping headers look like "7f0c2a000000-7f0c6a000000 rw-s 00000000 00:05 1234 /dev/cmem_rcc"
+    auto dash = line.find('-');
+    auto space = line.find(' ');
+    if (dash != std::string::npos && space != std::string::npos && dash < space &&
+        line.find_first_not_of("0123456789abcdef") == dash) {
+      uintptr_t start = std::stoull(line.substr(0, dash), nullptr, 16);
+      uintptr_t end = std::stoull(line.substr(dash + 1, space - dash - 1), nullptr, 16);
+      in_mapping = (start <= address && address < end);
+    } else if (in_mapping && line.rfind("KernelPageSize:", 0) == 0) {
+      std::istringstream fields(line.substr(15));
+      size_t kb = 0;
+      fields >> kb;
+      return kb * 1024;
+    }
+  }
+  return 0;
+}
+
+int
+query_numa_node(const void* addr)
+{
+  void* page = const_cast<void*>(addr); // NOLINT
+  int status = -1;
+  // move_pages without target nodes only reports where the page is
+  if (syscall(SYS_move_pages, 0, 1, &page, nullptr, &status, 0) != 0 || status < 0) {
+    return -1;
+  }
+  return status;
+}
+
+int
+query_physical_numa_node(u_long paddr) // NOLINT(runtime/int)
+{
+  std::ifstream block_size_file("/sys/devices/system/memory/block_size_bytes");
+  std::string block_size_hex;
+  if (!(block_size_file >> block_size_hex)) {
+    return -1;
+  }
+  u_long block_size = std::stoul(block_size_hex, nullptr, 16); // NOLINT(runtime/int)
+  if (block_size == 0) {
+    return -1;
+  }
+  std::string memory_block = "/memory" + std::to_string(paddr / block_size);
+  for (int node = 0; node < 64; ++node) {
+    std::ifstream node_block("/sys/devices/system/node/node" + std::to_string(node) + memory_block + "/online");
+    if (node_block.good()) {
+      return node;
+    }
+  }
+  return -1;
+}
+
+void
+prefault(void* addr, size_t size, size_t page_size, size_t num_threads)
+{
+  page_size = std::max<size_t>(page_size, 4096);
+  size_t num_pages = size / page_size;
+  num_threads = std::clamp<size_t>(num_threads, 1, std::max<size_t>(num_pages, 1));
+  size_t pages_per_thread = (num_pages + num_threads - 1) / num_threads;
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < num_threads; ++t) {
+    threads.emplace_back([=]() {
+      auto* first = static_cast<volatile char*>(addr);
+      for (size_t p = t * pages_per_thread; p < std::min(num_pages, (t + 1) * pages_per_thread); ++p) {
+        first[p * page_size] = 0;
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+} // namespace flxlibs
+} // namespace dunedaq
@@ -0,0 +1,67 @@
+/**
+ * @file DmaBufferAllocator.hpp Interface of the DMA buffer allocators
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef FLXLIBS_SRC_DMABUFFERALLOCATOR_HPP_
+#define FLXLIBS_SRC_DMABUFFERALLOCATOR_HPP_
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace dunedaq::flxlibs {
+
+/**
+ * @brief A DMA buffer, with where it actually ended up: NUMA node and page size
+ * are queried from the kernel after allocation, -1 and 0 if unknown.
+ */
+struct DmaBuffer
+{
+  int handle{ -1 };
+  u_long paddr{ 0 }; // NOLINT(runtime/int) address the card writes to
+  u_long vaddr{ 0 }; // NOLINT(runtime/int) address the software reads from
+  size_t size{ 0 };
+  int numa_node{ -1 };
+  size_t page_size{ 0 };
+};
+
+/**
+ * @brief Allocates the circular DMA buffers of CardWrapper. Buffers are prefaulted
+ * in parallel on allocation, so that no page faults are taken once data flows.
+ */
+class DmaBufferAllocator
+{
+public:
+  DmaBufferAllocator() = default;
+  virtual ~DmaBufferAllocator() = default;
+  DmaBufferAllocator(const DmaBufferAllocator&) = delete;            ///< Not copy-constructible
+  DmaBufferAllocator& operator=(const DmaBufferAllocator&) = delete; ///< Not copy-assignable
+  DmaBufferAllocator(DmaBufferAllocator&&) = delete;                 ///< Not move-constructible
+  DmaBufferAllocator& operator=(DmaBufferAllocator&&) = delete;      ///< Not move-assignable
+
+  virtual std::string name() const = 0;
+  // Returns false if the buffer couldn't be allocated. Fills in the placement.
+  virtual bool allocate(uint8_t numa, size_t size, DmaBuffer& buffer) = 0; // NOLINT(build/unsigned)
+  virtual void release(DmaBuffer& buffer) = 0;
+  // Whether paddr is a virtual address, as needed by software card backends
+  virtual bool virtual_dma_addresses() const = 0;
+};
+
+// Kernel placement of a mapping: page size from /proc/self/smaps, 0 if not found
+size_t query_page_size(const void* addr);
+// NUMA node of a mapped page via move_pages, -1 if the kernel can't tell
+int query_numa_node(const void* addr);
+// NUMA node of a physical address from the sysfs memory blocks, -1 if not found
+int query_physical_numa_node(u_long paddr); // NOLINT(runtime/int)
+// Touches every page of the buffer from num_threads threads, so that no page faults
+// are taken once data flows. Writes zeroes.
+void prefault(void* addr, size_t size, size_t page_size, size_t num_threads);
+
+} // namespace dunedaq::flxlibs
+
+#endif // FLXLIBS_SRC_DMABUFFERALLOCATOR_HPP_
@@ -11,14 +11,25 @@
 #define FLXLIBS_SRC_ELINKCONCEPT_HPP_
 
 #include "DefaultParserImpl.hpp"
+#include "FelixBlockFormat.hpp"
+#include "FelixIssues.hpp"
+#include "FelixStatistics.hpp"
+#include "ParserWorkerPool.hpp"
+#include "QueueWaiter.hpp"
+#include "ThreadAffinity.hpp"
+
+#include "flxlibs/DmaLeaseTable.hpp"
 
 #include "appfwk/DAQModule.hpp"
 #include "packetformat/detail/block_parser.hpp"
 #include <nlohmann/json.hpp>
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <vector>
 
 namespace dunedaq {
 namespace flxlibs {
@@ -34,9 +45,7 @@ public:
     , m_link_tag(0)
     , m_elink_str("")
     , m_elink_source_tid("")
-  {
-    m_parser = std::make_unique<felix::packetformat::BlockParser<DefaultParserImpl>>(m_parser_impl);
-  }
+  {}
   ~ElinkConcept() {}
 
   ElinkConcept(const ElinkConcept&) = delete;            ///< ElinkConcept is not copy-constructible
@@ -49,11 +58,91 @@ public:
   virtual void conf(const nlohmann::json& args, size_t block_size, bool is_32b_trailers) = 0;
   virtual void start(const nlohmann::json& args) = 0;
   virtual void stop(const nlohmann::json& args) = 0;
+  virtual void scrap(const nlohmann::json& args) = 0;
   virtual void get_info(opmonlib::InfoCollector& ci, int level) = 0;
 
   virtual bool queue_in_block_address(uint64_t block_addr) = 0; // NOLINT
 
-  DefaultParserImpl& get_parser() { return std::ref(m_parser_impl); }
+  // Router entry point: a plain function that enqueues without a virtual dispatch, or
+  // that parses the block right away for an inline elink
+  using enqueue_fn_t = bool (*)(ElinkConcept*, uint64_t); // NOLINT(build/unsigned)
+  virtual enqueue_fn_t get_enqueue_fn() const = 0;
+
+  // Worker pool entry points: parses at most max_blocks queued blocks and returns the
+  // number parsed. Called by one worker at a time.
+  virtual size_t parse_queued_blocks(size_t max_blocks) = 0;
+  virtual size_t queued_blocks() const = 0;
+
+  // Handlers of an elink with a DefaultParserImpl. Elinks with a policy parser have their
+  // handlers fixed at compile time and never call these.
+  DefaultParserImpl& get_parser()
+  {
+    if (m_parser == nullptr) {
+      throw ConfigurationError(ERS_HERE, m_elink_str + " has a policy parser, its handlers can't be rebound");
+    }
+    return m_parser_impl;
+  }
+
+  // Overrun detection on the 5 bit block sequence number. Called by the router for every
+  // block of the elink, from its single producer thread. Returns the blocks missing since
+  // the previous block; a gap of 32 blocks or more is only seen modulo 32.
+  size_t check_block_seqnum(unsigned seqnum)
+  {
+    size_t lost = 0;
+    if (m_last_seqnum >= 0) {
+      lost = (seqnum + blockformat::seqnum_modulo - m_last_seqnum - 1) % blockformat::seqnum_modulo;
+      if (lost != 0) {
+        m_seqnum_stats.lost_block_ctr += lost;
+        m_seqnum_stats.gap_ctr++;
+      }
+    }
+    m_last_seqnum = seqnum;
+    return lost;
+  }
+
+  // On stop, queued blocks are parsed until this deadline and discarded after it
+  void set_drain_deadline(std::chrono::steady_clock::time_point deadline) { m_drain_deadline = deadline; }
+
+  // CPUs of the parser thread, applied when the thread starts parsing
+  void set_cpus(const std::vector<int>& cpus) { m_cpus = cpus; }
+
+  // Parse in the pool's workers from the next start on. nullptr: parse in an own thread.
+  void set_parser_pool(ParserWorkerPool* pool)
+  {
+    m_parser_pool = pool;
+    m_notify_waiter = (pool != nullptr) ? &pool->get_waiter() : &m_waiter;
+  }
+
+  // Most blocks the parser takes from the queue at once
+  void set_parse_batch(size_t batch_blocks) { m_batch_blocks = std::max<size_t>(batch_blocks, 1); }
+
+  // Busy-spins and yields of an idle parser before it parks
+  void set_wait_policy(size_t spin_count, size_t yield_count)
+  {
+    m_spin_count = spin_count;
+    m_yield_count = yield_count;
+  }
+
+  // Wakes the parser of the elink if it is parked. The router calls it after a
+  // std::atomic_thread_fence(std::memory_order_seq_cst) that follows its enqueues.
+  void notify_parser() { m_notify_waiter->notify(); }
+
+  // Parse on the router's thread, set before the elink is added to a routing table
+  void set_inline_parse(bool inline_parse) { m_inline_parse = inline_parse; }
+  bool is_inline_parse() const { return m_inline_parse; }
+
+  // Decode 32b trailer blocks with BlockDecoder32b instead of packetformat's BlockParser, set before conf
+  void set_native_decoder(bool native_decoder) { m_native_decoder = native_decoder; }
+
+  // Holds on the DMA buffer the elink's blocks arrive in, for zero-copy chunks. The router
+  // holds every block it hands out, the elink releases it once parsed or dropped.
+  void set_lease_table(DmaLeaseTable* leases) { m_leases = leases; }
+  void release_block(uint64_t block_addr) // NOLINT(build/unsigned)
+  {
+    if (m_leases != nullptr) {
+      m_leases->release(block_addr);
+    }
+  }
 
   void set_ids(int card, int slr, int id, int tag)
   {
@@ -79,7 +168,7 @@ public:
   }
 
 protected:
-  // Block Parser
+  // Block Parser, only built by elinks with a DefaultParserImpl
   DefaultParserImpl m_parser_impl;
   std::unique_ptr<felix::packetformat::BlockParser<DefaultParserImpl>> m_parser;
 
@@ -91,6 +180,24 @@ protected:
   std::string m_opmon_str;
   std::string m_elink_source_tid;
   std::chrono::time_point<std::chrono::high_resolution_clock> m_t0;
+  std::vector<int> m_cpus;
+  std::atomic<int> m_cpu{ -1 };
+  ParserWorkerPool* m_parser_pool{ nullptr };
+  bool m_inline_parse{ false };
+  bool m_native_decoder{ false };
+  DmaLeaseTable* m_leases{ nullptr };
+  QueueWaiter m_waiter;
+  QueueWaiter* m_notify_waiter{ &m_waiter };
+  size_t m_batch_blocks{ 1 };
+  size_t m_spin_count{ 0 };
+  size_t m_yield_count{ 0 };
+  stats::ParseLatencyStats m_latency_stats;
+  stats::ParseBatchStats m_batch_stats;
+  stats::InlineParseStats m_inline_stats;
+  int m_last_seqnum{ -1 }; // -1 until the first block of a run
+  stats::SeqnumStats m_seqnum_stats;
+  std::chrono::steady_clock::time_point m_drain_deadline;
+  stats::DrainStats m_drain_stats;
 
 private:
 };
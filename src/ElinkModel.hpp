@@ -8,7 +8,13 @@
 #ifndef FLXLIBS_SRC_ELINKMODEL_HPP_
 #define FLXLIBS_SRC_ELINKMODEL_HPP_
 
+#include "BlockBatch.hpp"
+#include "BlockDecoder32b.hpp"
 #include "ElinkConcept.hpp"
+#include "ParserWorkerPool.hpp"
+#include "PolicyParserImpl.hpp"
+#include "PollBackoff.hpp"
+#include "WorkCompletion.hpp"
 
 #include "packetformat/block_format.hpp"
 
@@ -24,12 +30,19 @@
 
 #include <atomic>
 #include <memory>
+#include <sched.h>
 #include <mutex>
 #include <string>
+#include <type_traits>
 
 namespace dunedaq::flxlibs {
 
-template<class TargetPayloadType>
+/**
+ * @brief ParserImpl is DefaultParserImpl, whose handlers are rebound at runtime through
+ * get_parser(), or a PolicyParserImpl with handlers fixed at compile time, set up
+ * through get_policy_parser().
+ */
+template<class TargetPayloadType, class ParserImpl = DefaultParserImpl>
 class ElinkModel : public ElinkConcept
 {
 public:
@@ -45,8 +58,11 @@ public:
   ElinkModel()
     : ElinkConcept()
     , m_run_marker{ false }
-    , m_parser_thread(0)
-  {}
+  {
+    if constexpr (!s_policy_parser) {
+      m_parser = std::make_unique<felix::packetformat::BlockParser<DefaultParserImpl>>(m_parser_impl);
+    }
+  }
   ~ElinkModel() {}
 
   void set_sink(const std::string& sink_name) override
@@ -63,6 +79,8 @@ public:
 
   std::shared_ptr<err_sink_t>& get_error_sink() { return m_error_sink_queue; }
 
+  ParserImpl& get_policy_parser() { return m_policy.impl; }
+
   void init(const data_t& /*args*/, const size_t block_queue_capacity)
   {
     m_block_addr_queue = std::make_unique<folly::ProducerConsumerQueue<uint64_t>>(block_queue_capacity); // NOLINT
@@ -73,11 +91,24 @@ public:
     if (m_configured) {
       TLOG_DEBUG(5) << "ElinkModel is already configured!";
     } else {
-      m_parser_thread.set_name(inherited::m_elink_source_tid, inherited::m_link_tag);
       // if (inconsistency)
       // ers::fatal(ElinkConfigurationInconsistency(ERS_HERE, m_num_links));
 
-      m_parser->configure(block_size, is_32b_trailers); // unsigned bsize, bool trailer_is_32bit
+      if constexpr (s_policy_parser) {
+        m_policy.parser.configure(block_size, is_32b_trailers);
+        m_policy.native_decode = inherited::m_native_decoder && is_32b_trailers;
+        if (m_policy.native_decode) {
+          m_policy.decoder.configure(block_size);
+          TLOG_DEBUG(5) << inherited::m_elink_str << " decodes blocks natively"
+                        << (m_policy.decoder.uses_simd() ? " with AVX2" : "");
+        }
+      } else {
+        m_parser->configure(block_size, is_32b_trailers); // unsigned bsize, bool trailer_is_32bit
+      }
+      if (inherited::m_native_decoder && !(s_policy_parser && is_32b_trailers)) {
+        TLOG() << inherited::m_elink_str << " can't use the native block decoder, it needs 32b trailers and a policy parser";
+      }
+      m_block_size = block_size;
       m_configured = true;
     }
   }
@@ -87,7 +118,20 @@ public:
     m_t0 = std::chrono::high_resolution_clock::now();
     if (!m_run_marker.load()) {
       set_running(true);
-      m_parser_thread.set_work(&ElinkModel::process_elink, this);
+      if (inherited::m_inline_parse) {
+        // The router parses the blocks, nothing to start
+      } else if (inherited::m_parser_pool != nullptr) {
+        inherited::m_parser_pool->attach(this);
+      } else {
+        // The own parser thread is only created for elinks that don't parse in a worker pool
+        if (m_parser_thread == nullptr) {
+          m_parser_thread = std::make_unique<readoutlibs::ReusableThread>(0);
+          m_parser_thread->set_name(inherited::m_elink_source_tid, inherited::m_link_tag);
+        }
+        if (!m_parser_completion.set_work(*m_parser_thread, &ElinkModel::process_elink, this)) {
+          TLOG() << inherited::m_elink_str << " parser thread is still busy!";
+        }
+      }
       TLOG_DEBUG(5) << "Started ElinkModel of link " << inherited::m_link_id << "...";
     } else {
       TLOG_DEBUG(5) << "ElinkModel of link " << inherited::m_link_id << " is already running!";
@@ -98,15 +142,32 @@ public:
   {
     if (m_run_marker.load()) {
       set_running(false);
-      while (!m_parser_thread.get_readiness()) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      if (inherited::m_inline_parse) {
+        // The card wrapper stopped first, the router parsed the last blocks
+      } else if (inherited::m_parser_pool != nullptr) {
+        inherited::m_parser_pool->detach(this);
+        drain_queue();
+      } else {
+        inherited::m_waiter.wake();
+        m_parser_completion.wait(*m_parser_thread);
       }
+      // The card wrapper stopped first, the sequence and the latency samples restart with the next run
+      inherited::m_last_seqnum = -1;
+      m_enqueued = 0;
+      m_dequeued = 0;
+      m_sample_index.store(s_no_sample);
       TLOG_DEBUG(5) << "Stopped ElinkModel of link " << m_link_id << "!";
     } else {
       TLOG_DEBUG(5) << "ElinkModel of link " << m_link_id << " is already stopped!";
     }
   }
 
+  void scrap(const data_t& /*args*/)
+  {
+    // The parser is configured again by the next conf
+    m_configured = false;
+  }
+
   void set_running(bool should_run)
   {
     bool was_running = m_run_marker.exchange(should_run);
@@ -116,36 +177,120 @@ public:
   bool queue_in_block_address(uint64_t block_addr) // NOLINT(build/unsigned)
   {
     if (m_block_addr_queue->write(block_addr)) { // ok write
+      if (++m_enqueued % m_latency_sample_interval == 0 && m_sample_index.load(std::memory_order_acquire) == s_no_sample) {
+        m_sample_ns = std::chrono::steady_clock::now().time_since_epoch().count();
+        m_sample_index.store(m_enqueued - 1, std::memory_order_release);
+      }
       return true;
     } else { // failed write
+      inherited::m_seqnum_stats.queue_full_ctr++;
+      inherited::release_block(block_addr);
       return false;
     }
   }
 
+  static bool enqueue_block_address(ElinkConcept* elink, uint64_t block_addr) // NOLINT(build/unsigned)
+  {
+    return static_cast<ElinkModel*>(elink)->ElinkModel::queue_in_block_address(block_addr);
+  }
+
+  static bool parse_block_inline(ElinkConcept* elink, uint64_t block_addr) // NOLINT(build/unsigned)
+  {
+    auto* model = static_cast<ElinkModel*>(elink);
+    auto t0 = std::chrono::steady_clock::now();
+    model->parse_block(block_addr);
+    model->release_block(block_addr);
+    model->m_inline_stats.parse_ns.fetch_add(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count(),
+      std::memory_order_relaxed);
+    return true;
+  }
+
+  enqueue_fn_t get_enqueue_fn() const override
+  {
+    return inherited::m_inline_parse ? &ElinkModel::parse_block_inline : &ElinkModel::enqueue_block_address;
+  }
+
+  size_t parse_queued_blocks(size_t max_blocks) override
+  {
+    size_t parsed = 0;
+    while (parsed < max_blocks) {
+      size_t batch = parse_batch(max_blocks - parsed);
+      if (batch == 0) {
+        break;
+      }
+      parsed += batch;
+    }
+    if (parsed != 0 && (m_blocks_since_cpu_sample += parsed) >= m_cpu_sample_interval) {
+      m_blocks_since_cpu_sample = 0;
+      inherited::m_cpu.store(sched_getcpu(), std::memory_order_relaxed);
+    }
+    return parsed;
+  }
+
+  size_t queued_blocks() const override { return m_block_addr_queue->sizeGuess(); }
+
   void get_info(opmonlib::InfoCollector& ci, int /*level*/)
   {
     felixcardreaderinfo::ELinkInfo info;
     auto now = std::chrono::high_resolution_clock::now();
-    auto& stats = m_parser_impl.get_stats();
 
     info.card_id = m_card_id;
     info.logical_unit = m_logical_unit;
     info.link_id = m_link_id;
     info.link_tag = m_link_tag;
+    info.cpu = m_cpu.load();
 
     double seconds = std::chrono::duration_cast<std::chrono::microseconds>(now - m_t0).count() / 1000000.;
 
-    info.num_short_chunks_processed = stats.short_ctr.exchange(0);
-    info.num_chunks_processed = stats.chunk_ctr.exchange(0);
-    info.num_subchunks_processed = stats.subchunk_ctr.exchange(0);
-    info.num_blocks_processed = stats.block_ctr.exchange(0);
-    info.num_short_chunks_processed_with_error = stats.error_short_ctr.exchange(0);
-    info.num_chunks_processed_with_error = stats.error_chunk_ctr.exchange(0);
-    info.num_subchunks_processed_with_error = stats.error_subchunk_ctr.exchange(0);
-    info.num_blocks_processed_with_error = stats.error_block_ctr.exchange(0);
-    info.num_subchunk_crc_errors = stats.subchunk_crc_error_ctr.exchange(0);
-    info.num_subchunk_trunc_errors = stats.subchunk_trunc_error_ctr.exchange(0);
-    info.num_subchunk_errors = stats.subchunk_error_ctr.exchange(0);
+    // The parser counters are never reset, the deltas are taken against the last snapshot
+    auto totals = parser_stats().snapshot();
+    auto delta = totals - m_last_parser_snapshot;
+    m_last_parser_snapshot = totals;
+    info.num_short_chunks_processed = delta.short_ctr;
+    info.num_chunks_processed = delta.chunk_ctr;
+    info.num_subchunks_processed = delta.subchunk_ctr;
+    info.num_blocks_processed = delta.block_ctr;
+    info.num_short_chunks_processed_with_error = delta.error_short_ctr;
+    info.num_chunks_processed_with_error = delta.error_chunk_ctr;
+    info.num_subchunks_processed_with_error = delta.error_subchunk_ctr;
+    info.num_blocks_processed_with_error = delta.error_block_ctr;
+    info.num_subchunk_crc_errors = delta.subchunk_crc_error_ctr;
+    info.num_subchunk_trunc_errors = delta.subchunk_trunc_error_ctr;
+    info.num_subchunk_errors = delta.subchunk_error_ctr;
+    info.total_short_chunks_processed = totals.short_ctr;
+    info.total_chunks_processed = totals.chunk_ctr;
+    info.total_subchunks_processed = totals.subchunk_ctr;
+    info.total_blocks_processed = totals.block_ctr;
+    info.total_processed_with_error =
+      totals.error_short_ctr + totals.error_chunk_ctr + totals.error_subchunk_ctr + totals.error_block_ctr;
+    info.num_lost_blocks = inherited::m_seqnum_stats.lost_block_ctr.exchange(0);
+    info.num_seqnum_gaps = inherited::m_seqnum_stats.gap_ctr.exchange(0);
+    info.num_queue_full_drops = inherited::m_seqnum_stats.queue_full_ctr.exchange(0);
+    info.num_blocks_drained = inherited::m_drain_stats.drained_block_ctr.exchange(0);
+    info.num_blocks_discarded = inherited::m_drain_stats.discarded_block_ctr.exchange(0);
+    auto& latency = inherited::m_latency_stats;
+    info.num_parser_parks = latency.park_ctr.exchange(0);
+    auto& batches = inherited::m_batch_stats;
+    info.num_parse_batches = batches.batch_ctr.exchange(0);
+    uint64_t batch_blocks = batches.block_ctr.exchange(0); // NOLINT(build/unsigned)
+    uint64_t batch_ns = batches.parse_ns.exchange(0);      // NOLINT(build/unsigned)
+    info.avg_blocks_per_batch = info.num_parse_batches ? static_cast<double>(batch_blocks) / info.num_parse_batches : 0.;
+    info.avg_parse_ns_per_block = batch_blocks ? static_cast<double>(batch_ns) / batch_blocks : 0.;
+    info.num_latency_samples = latency.sample_ctr.exchange(0);
+    uint64_t latency_ns = latency.sum_ns.exchange(0); // NOLINT(build/unsigned)
+    info.avg_parse_latency_us = info.num_latency_samples ? latency_ns / 1e3 / info.num_latency_samples : 0.;
+    info.max_parse_latency_us = latency.max_ns.exchange(0) / 1e3;
+    info.num_latency_below_1us = latency.hist[0].exchange(0);
+    info.num_latency_1_10us = latency.hist[1].exchange(0);
+    info.num_latency_10_100us = latency.hist[2].exchange(0);
+    info.num_latency_100us_1ms = latency.hist[3].exchange(0);
+    info.num_latency_1_10ms = latency.hist[4].exchange(0);
+    info.num_latency_10ms_up = latency.hist[5].exchange(0);
+    info.inline_parse = inherited::m_inline_parse;
+    uint64_t inline_ns = inherited::m_inline_stats.parse_ns.exchange(0); // NOLINT(build/unsigned)
+    info.inline_parse_time_ms = inline_ns / 1e6;
+    info.inline_parse_load = (seconds > 0) ? inline_ns / 1e9 / seconds : 0.;
     info.rate_blocks_processed = info.num_blocks_processed / seconds / 1000.;
     info.rate_chunks_processed = info.num_chunks_processed / seconds / 1000.;
 
@@ -173,6 +318,29 @@ private:
   // Types
   using UniqueBlockAddrQueue = std::unique_ptr<folly::ProducerConsumerQueue<uint64_t>>; // NOLINT(build/unsigned)
 
+  // Parser: a policy parser replaces the DefaultParserImpl of ElinkConcept
+  static constexpr bool s_policy_parser = !std::is_same_v<ParserImpl, DefaultParserImpl>;
+  struct PolicyParser
+  {
+    ParserImpl impl;
+    felix::packetformat::BlockParser<ParserImpl> parser{ impl };
+    BlockDecoder32b decoder;
+    bool native_decode{ false };
+  };
+  struct NoPolicyParser
+  {};
+  std::conditional_t<s_policy_parser, PolicyParser, NoPolicyParser> m_policy;
+  stats::ParserSnapshot m_last_parser_snapshot; // read by get_info only
+
+  stats::ParserStats& parser_stats()
+  {
+    if constexpr (s_policy_parser) {
+      return m_policy.impl.get_stats();
+    } else {
+      return m_parser_impl.get_stats();
+    }
+  }
+
   // Internals
   std::atomic<bool> m_run_marker;
   bool m_configured{ false };
@@ -187,20 +355,120 @@ private:
 
   // Processor
   inline static const std::string m_parser_thread_name = "elinkp";
-  readoutlibs::ReusableThread m_parser_thread;
+  static constexpr size_t m_cpu_sample_interval = 4096;
+  // Parks end at the latest after this, a lost wakeup can't stall the elink for longer
+  static constexpr std::chrono::microseconds m_max_park{ 100000 };
+  std::unique_ptr<readoutlibs::ReusableThread> m_parser_thread;
+  WorkCompletion m_parser_completion;
+  size_t m_blocks_since_cpu_sample{ 0 };
+  size_t m_block_size{ 0 };
+
+  // Every m_latency_sample_interval-th queued block is timestamped, if the previous sample
+  // was parsed. The router and the parser count the blocks they queue and dequeue, the
+  // parser finds the sampled block by its index.
+  static constexpr uint64_t s_no_sample = ~uint64_t(0);            // NOLINT(build/unsigned)
+  static constexpr uint64_t m_latency_sample_interval = 64;        // NOLINT(build/unsigned)
+  uint64_t m_enqueued{ 0 };                                        // NOLINT(build/unsigned) router thread
+  uint64_t m_dequeued{ 0 };                                        // NOLINT(build/unsigned) parser
+  uint64_t m_sample_ns{ 0 };                                       // NOLINT(build/unsigned)
+  alignas(64) std::atomic<uint64_t> m_sample_index{ s_no_sample }; // NOLINT(build/unsigned)
+
+  // Called for every block taken from the queue, before it is parsed or discarded
+  void sample_latency()
+  {
+    if (m_dequeued++ == m_sample_index.load(std::memory_order_acquire)) {
+      uint64_t ns = std::chrono::steady_clock::now().time_since_epoch().count() - m_sample_ns; // NOLINT
+      auto& latency = inherited::m_latency_stats;
+      latency.sample_ctr.fetch_add(1, std::memory_order_relaxed);
+      latency.sum_ns.fetch_add(ns, std::memory_order_relaxed);
+      stats::update_max(latency.max_ns, ns);
+      latency.hist[stats::latency_hist_bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+      m_sample_index.store(s_no_sample, std::memory_order_release);
+    }
+  }
+
+  void parse_block(uint64_t block_addr) // NOLINT(build/unsigned)
+  {
+    const auto* block = const_cast<felix::packetformat::block*>(
+      felix::packetformat::block_from_bytes(reinterpret_cast<const char*>(block_addr)) // NOLINT
+    );
+    if constexpr (s_policy_parser) {
+      if (m_policy.native_decode) {
+        m_policy.decoder.decode(block, m_policy.impl);
+      } else {
+        m_policy.parser.process(block);
+      }
+    } else {
+      m_parser->process(block);
+    }
+  }
+
+  // Takes up to max_blocks blocks from the queue and parses them, stats once per batch
+  size_t parse_batch(size_t max_blocks)
+  {
+    auto t0 = std::chrono::steady_clock::now();
+    size_t parsed = parse_block_batch(*m_block_addr_queue, max_blocks, m_block_size, [this](uint64_t block_addr) { // NOLINT
+      sample_latency();
+      parse_block(block_addr);
+      inherited::release_block(block_addr);
+    });
+    if (parsed != 0) {
+      auto& batches = inherited::m_batch_stats;
+      batches.batch_ctr.fetch_add(1, std::memory_order_relaxed);
+      batches.block_ctr.fetch_add(parsed, std::memory_order_relaxed);
+      batches.parse_ns.fetch_add(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count(),
+        std::memory_order_relaxed);
+    }
+    return parsed;
+  }
+
   void process_elink()
   {
+    WorkCompletion::Guard completion_guard(m_parser_completion);
+    if (!set_current_thread_affinity(inherited::m_cpus)) {
+      TLOG() << inherited::m_elink_str << " couldn't pin parser thread to CPUs " << cpus_to_string(inherited::m_cpus);
+    }
+    // Spin and yield on an empty queue, then park until the router queues blocks
+    PollBackoff backoff;
+    backoff.configure(inherited::m_spin_count, inherited::m_yield_count, 1, 1);
+    size_t blocks = 0;
     while (m_run_marker.load()) {
-      uint64_t block_addr;                        // NOLINT
-      if (m_block_addr_queue->read(block_addr)) { // read success
-        const auto* block = const_cast<felix::packetformat::block*>(
-          felix::packetformat::block_from_bytes(reinterpret_cast<const char*>(block_addr)) // NOLINT
-        );
-        m_parser->process(block);
-      } else { // couldn't read from queue
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      size_t parsed = parse_batch(inherited::m_batch_blocks);
+      if (parsed != 0) {
+        if ((blocks += parsed) >= m_cpu_sample_interval) {
+          blocks = 0;
+          inherited::m_cpu.store(sched_getcpu(), std::memory_order_relaxed);
+        }
+        backoff.reset();
+      } else if (!backoff.spun_out()) { // couldn't read from queue
+        backoff.wait();
+      } else {
+        inherited::m_cpu.store(sched_getcpu(), std::memory_order_relaxed);
+        inherited::m_latency_stats.park_ctr++;
+        inherited::m_waiter.park([this] { return !m_block_addr_queue->isEmpty() || !m_run_marker.load(); },
+                                 m_max_park);
+        backoff.reset();
       }
     }
+    drain_queue();
+  }
+
+  // Drain: the card wrapper stopped first, the queue holds the rest of the run
+  void drain_queue()
+  {
+    uint64_t block_addr; // NOLINT
+    while (std::chrono::steady_clock::now() < inherited::m_drain_deadline && m_block_addr_queue->read(block_addr)) {
+      sample_latency();
+      parse_block(block_addr);
+      inherited::release_block(block_addr);
+      inherited::m_drain_stats.drained_block_ctr++;
+    }
+    // Past the deadline: never parse stale addresses in the next run
+    while (m_block_addr_queue->read(block_addr)) {
+      inherited::release_block(block_addr);
+      inherited::m_drain_stats.discarded_block_ctr++;
+    }
   }
 };
 
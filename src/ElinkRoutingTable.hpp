@@ -0,0 +1,77 @@
+/**
+ * @file ElinkRoutingTable.hpp Flat table from elink tag to elink handler
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef FLXLIBS_SRC_ELINKROUTINGTABLE_HPP_
+#define FLXLIBS_SRC_ELINKROUTINGTABLE_HPP_
+
+#include "ElinkConcept.hpp"
+#include "FelixStatistics.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace dunedaq::flxlibs {
+
+struct ElinkRoute
+{
+  ElinkConcept* elink{ nullptr };
+  ElinkConcept::enqueue_fn_t enqueue{ nullptr };
+};
+
+/**
+ * @brief Routes of the blocks of a DMA descriptor, indexed directly by the elink field
+ * of the block header. Built at configure, read-only on the DMA thread: routing a block
+ * is one table load and one indirect call. Unrouted tags have a null elink, blocks of
+ * those are counted per tag by the router thread of the table.
+ */
+class alignas(64) ElinkRoutingTable
+{
+public:
+  static constexpr size_t s_num_elinks = stats::RouterStats::s_num_elinks;
+
+  // Returns false if the tag is out of range or already routed
+  bool add(unsigned elink_tag, ElinkConcept* elink)
+  {
+    if (elink_tag >= s_num_elinks || m_routes[elink_tag].elink != nullptr) {
+      return false;
+    }
+    m_routes[elink_tag] = ElinkRoute{ elink, elink->get_enqueue_fn() };
+    m_elinks.push_back(elink);
+    return true;
+  }
+
+  // Wakes the parked parsers after a span of blocks was routed. One fence orders all
+  // enqueues of the span before the checks for parked parsers.
+  void notify_parsers()
+  {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (auto* elink : m_elinks) {
+      elink->notify_parser();
+    }
+  }
+
+  const ElinkRoute& route(unsigned elink_tag) const { return m_routes[elink_tag & (s_num_elinks - 1)]; }
+  size_t size() const { return m_elinks.size(); }
+
+  void count_unknown(unsigned elink_tag)
+  {
+    m_unknown_stats.unknown_elink_ctr.fetch_add(1, std::memory_order_relaxed);
+    m_unknown_stats.unknown_elink_hist[elink_tag & (s_num_elinks - 1)].fetch_add(1, std::memory_order_relaxed);
+  }
+  stats::RouterStats& get_unknown_stats() { return m_unknown_stats; }
+
+private:
+  std::array<ElinkRoute, s_num_elinks> m_routes{};
+  std::vector<ElinkConcept*> m_elinks;
+  stats::RouterStats m_unknown_stats;
+};
+
+} // namespace dunedaq::flxlibs
+
+#endif // FLXLIBS_SRC_ELINKROUTINGTABLE_HPP_
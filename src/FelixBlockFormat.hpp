@@ -0,0 +1,96 @@
+/**
+ * @file FelixBlockFormat.hpp Layout of FELIX to-host blocks and subchunk trailers
+ *
+ * A block starts with a 4 byte header (elink, sequence number, start-of-block
+ * marker), followed by subchunks. Every subchunk is its payload, padded to
+ * the trailer size, followed by its trailer. The last trailer sits at the
+ * very end of the block, so blocks are decoded from the back.
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef FLXLIBS_SRC_FELIXBLOCKFORMAT_HPP_
+#define FLXLIBS_SRC_FELIXBLOCKFORMAT_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace dunedaq::flxlibs::blockformat {
+
+constexpr std::size_t header_size = 4;
+constexpr uint16_t sob_16b_trailer = 0xABCD; // NOLINT(build/unsigned)
+constexpr uint16_t sob_32b_trailer = 0xC0CE; // NOLINT(build/unsigned)
+constexpr uint32_t seqnum_modulo = 32;       // NOLINT(build/unsigned) 5 bit block sequence number
+
+enum class SubchunkType : uint8_t // NOLINT(build/unsigned)
+{
+  kNull = 0,
+  kFirst = 1,
+  kLast = 2,
+  kBoth = 3,
+  kMiddle = 4,
+  kTimeout = 5,
+  kOutOfBand = 7
+};
+
+struct SubchunkTrailer
+{
+  SubchunkType type{ SubchunkType::kNull };
+  bool trunc{ false };
+  bool err{ false };
+  bool crcerr{ false };
+  uint32_t length{ 0 }; // NOLINT(build/unsigned) payload bytes, without padding
+};
+
+// 32 bit trailer: type[31:29] trunc[28] err[27] crcerr[26] busy[25] length[15:0]
+inline uint32_t // NOLINT(build/unsigned)
+encode_trailer_32b(const SubchunkTrailer& t)
+{
+  return (static_cast<uint32_t>(t.type) << 29) | (static_cast<uint32_t>(t.trunc) << 28) | // NOLINT
+         (static_cast<uint32_t>(t.err) << 27) | (static_cast<uint32_t>(t.crcerr) << 26) | // NOLINT
+         (t.length & 0xFFFF);
+}
+
+inline SubchunkTrailer
+decode_trailer_32b(uint32_t word) // NOLINT(build/unsigned)
+{
+  SubchunkTrailer t;
+  t.type = static_cast<SubchunkType>((word >> 29) & 0x7);
+  t.trunc = (word >> 28) & 0x1;
+  t.err = (word >> 27) & 0x1;
+  t.crcerr = (word >> 26) & 0x1;
+  t.length = word & 0xFFFF;
+  return t;
+}
+
+// 16 bit trailer: type[15:13] trunc[12] err[11] crcerr[10] length[9:0]
+inline uint16_t // NOLINT(build/unsigned)
+encode_trailer_16b(const SubchunkTrailer& t)
+{
+  return static_cast<uint16_t>((static_cast<uint32_t>(t.type) << 13) | (static_cast<uint32_t>(t.trunc) << 12) | // NOLINT
+                               (static_cast<uint32_t>(t.err) << 11) | (static_cast<uint32_t>(t.crcerr) << 10) | // NOLINT
+                               (t.length & 0x3FF));
+}
+
+inline SubchunkTrailer
+decode_trailer_16b(uint16_t word) // NOLINT(build/unsigned)
+{
+  SubchunkTrailer t;
+  t.type = static_cast<SubchunkType>((word >> 13) & 0x7);
+  t.trunc = (word >> 12) & 0x1;
+  t.err = (word >> 11) & 0x1;
+  t.crcerr = (word >> 10) & 0x1;
+  t.length = word & 0x3FF;
+  return t;
+}
+
+inline std::size_t
+padded_length(std::size_t length, std::size_t trailer_size)
+{
+  return (length + trailer_size - 1) / trailer_size * trailer_size;
+}
+
+} // namespace dunedaq::flxlibs::blockformat
+
+#endif // FLXLIBS_SRC_FELIXBLOCKFORMAT_HPP_
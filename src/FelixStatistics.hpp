@@ -8,28 +8,241 @@
 #ifndef FLXLIBS_SRC_FELIXSTATISTICS_HPP_
 #define FLXLIBS_SRC_FELIXSTATISTICS_HPP_
 
+#include <array>
 #include <atomic>
+#include <cstddef>
+#include <cstdint>
 
 namespace dunedaq::flxlibs::stats {
 
 using counter_t = std::atomic<uint64_t>; // NOLINT(build/unsigned)
 
-struct ParserStats
+// Monotonic counter with a single writer at a time, e.g. the parser of an elink, or the pool
+// worker that owns the elink. The increment is a relaxed load and store instead of a locked
+// read-modify-write; readers on other threads load it relaxed and never reset it.
+class local_counter_t
 {
-  counter_t packet_ctr{ 0 };
-  counter_t short_ctr{ 0 };
-  counter_t chunk_ctr{ 0 };
-  counter_t subchunk_ctr{ 0 };
+public:
+  void operator++(int) { add(1); }
+  void add(uint64_t n) { m_value.store(m_value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); } // NOLINT(build/unsigned)
+  uint64_t load() const { return m_value.load(std::memory_order_relaxed); } // NOLINT(build/unsigned)
+
+private:
+  std::atomic<uint64_t> m_value{ 0 }; // NOLINT(build/unsigned)
+};
+
+struct ParserSnapshot
+{
+  uint64_t packet_ctr{ 0 }; // NOLINT(build/unsigned)
+  uint64_t short_ctr{ 0 }; // NOLINT(build/unsigned)
+  uint64_t chunk_ctr{ 0 }; // NOLINT(build/unsigned)
+  uint64_t subchunk_ctr{ 0 }; // NOLINT(build/unsigned)
+  uint64_t block_ctr{ 0 }; // NOLINT(build/unsigned)
+  uint64_t error_short_ctr{ 0 }; // NOLINT(build/unsigned)
+  uint64_t error_chunk_ctr{ 0 }; // NOLINT(build/unsigned)
+  uint64_t error_subchunk_ctr{ 0 }; // NOLINT(build/unsigned)
+  uint64_t error_block_ctr{ 0 }; // NOLINT(build/unsigned)
+  uint64_t subchunk_crc_error_ctr{ 0 }; // NOLINT(build/unsigned)
+  uint64_t subchunk_trunc_error_ctr{ 0 }; // NOLINT(build/unsigned)
+  uint64_t subchunk_error_ctr{ 0 }; // NOLINT(build/unsigned)
+
+  ParserSnapshot operator-(const ParserSnapshot& since) const
+  {
+    ParserSnapshot delta;
+    delta.packet_ctr = packet_ctr - since.packet_ctr;
+    delta.short_ctr = short_ctr - since.short_ctr;
+    delta.chunk_ctr = chunk_ctr - since.chunk_ctr;
+    delta.subchunk_ctr = subchunk_ctr - since.subchunk_ctr;
+    delta.block_ctr = block_ctr - since.block_ctr;
+    delta.error_short_ctr = error_short_ctr - since.error_short_ctr;
+    delta.error_chunk_ctr = error_chunk_ctr - since.error_chunk_ctr;
+    delta.error_subchunk_ctr = error_subchunk_ctr - since.error_subchunk_ctr;
+    delta.error_block_ctr = error_block_ctr - since.error_block_ctr;
+    delta.subchunk_crc_error_ctr = subchunk_crc_error_ctr - since.subchunk_crc_error_ctr;
+    delta.subchunk_trunc_error_ctr = subchunk_trunc_error_ctr - since.subchunk_trunc_error_ctr;
+    delta.subchunk_error_ctr = subchunk_error_ctr - since.subchunk_error_ctr;
+    return delta;
+  }
+};
+
+// Parser counters of one elink. Written only by the thread parsing the elink at the time,
+// see local_counter_t, and never reset: readers take a snapshot() and subtract the previous
+// one. Aligned to whole cache lines, so the parse loop does not share a line with the data
+// of the router or of other elinks.
+struct alignas(64) ParserStats
+{
+  local_counter_t packet_ctr;
+  local_counter_t short_ctr;
+  local_counter_t chunk_ctr;
+  local_counter_t subchunk_ctr;
+  local_counter_t block_ctr;
+  local_counter_t error_short_ctr;
+  local_counter_t error_chunk_ctr;
+  local_counter_t error_subchunk_ctr;
+  local_counter_t error_block_ctr;
+  local_counter_t subchunk_crc_error_ctr;
+  local_counter_t subchunk_trunc_error_ctr;
+  local_counter_t subchunk_error_ctr;
+
+  ParserSnapshot snapshot() const
+  {
+    ParserSnapshot snap;
+    snap.packet_ctr = packet_ctr.load();
+    snap.short_ctr = short_ctr.load();
+    snap.chunk_ctr = chunk_ctr.load();
+    snap.subchunk_ctr = subchunk_ctr.load();
+    snap.block_ctr = block_ctr.load();
+    snap.error_short_ctr = error_short_ctr.load();
+    snap.error_chunk_ctr = error_chunk_ctr.load();
+    snap.error_subchunk_ctr = error_subchunk_ctr.load();
+    snap.error_block_ctr = error_block_ctr.load();
+    snap.subchunk_crc_error_ctr = subchunk_crc_error_ctr.load();
+    snap.subchunk_trunc_error_ctr = subchunk_trunc_error_ctr.load();
+    snap.subchunk_error_ctr = subchunk_error_ctr.load();
+    return snap;
+  }
+};
+
+struct SeqnumStats
+{
+  counter_t lost_block_ctr{ 0 };
+  counter_t gap_ctr{ 0 };
+  counter_t queue_full_ctr{ 0 }; // blocks dropped by a full elink queue
+};
+
+struct RouterStats
+{
+  static constexpr size_t s_num_elinks = 2048; // 11 bit elink field of the block header
+  counter_t unknown_elink_ctr{ 0 };
+  std::array<counter_t, s_num_elinks> unknown_elink_hist{};
+};
+
+struct DrainStats
+{
+  counter_t drained_block_ctr{ 0 };
+  counter_t discarded_block_ctr{ 0 };
+  counter_t timeout_ctr{ 0 };
+  counter_t stop_ns{ 0 }; // gauge, duration of the last stop
+};
+
+// Enqueue to parse latency of sampled blocks, and parks of the parser
+struct ParseLatencyStats
+{
+  static constexpr size_t s_num_buckets = 6; // <1us, <10us, <100us, <1ms, <10ms, more
+
+  counter_t sample_ctr{ 0 };
+  counter_t sum_ns{ 0 };
+  counter_t max_ns{ 0 };
+  std::array<counter_t, s_num_buckets> hist{};
+  counter_t park_ctr{ 0 };
+};
+
+inline size_t
+latency_hist_bucket(uint64_t ns) // NOLINT(build/unsigned)
+{
+  size_t bucket = 0;
+  for (uint64_t limit = 1000; bucket < ParseLatencyStats::s_num_buckets - 1 && ns >= limit; limit *= 10) { // NOLINT
+    ++bucket;
+  }
+  return bucket;
+}
+
+// Batches of blocks taken from an elink queue at once
+struct ParseBatchStats
+{
+  counter_t batch_ctr{ 0 };
   counter_t block_ctr{ 0 };
-  counter_t error_short_ctr{ 0 };
-  counter_t error_chunk_ctr{ 0 };
-  counter_t error_subchunk_ctr{ 0 };
-  counter_t error_block_ctr{ 0 };
-  counter_t subchunk_crc_error_ctr{ 0 };
-  counter_t subchunk_trunc_error_ctr{ 0 };
-  counter_t subchunk_error_ctr{ 0 };
+  counter_t parse_ns{ 0 };
 };
 
+// Blocks of an inline elink, parsed by the router on the DMA thread
+struct InlineParseStats
+{
+  counter_t parse_ns{ 0 };
+};
+
+// Gauges, duration of the last transition of each phase
+struct TransitionStats
+{
+  counter_t configure_ns{ 0 };
+  counter_t start_card_ns{ 0 };
+  counter_t start_elinks_ns{ 0 };
+  counter_t stop_card_ns{ 0 };
+  counter_t stop_elinks_ns{ 0 };
+  counter_t scrap_ns{ 0 };
+};
+
+struct DMAStats
+{
+  counter_t spin_wakeup_ctr{ 0 };
+  counter_t yield_wakeup_ctr{ 0 };
+  counter_t sleep_wakeup_ctr{ 0 };
+  counter_t interrupt_ctr{ 0 };
+  counter_t deadline_flush_ctr{ 0 };
+  counter_t to_poll_switch_ctr{ 0 };
+  counter_t to_interrupt_switch_ctr{ 0 };
+  counter_t interrupt_mode_ns{ 0 };
+  counter_t poll_mode_ns{ 0 };
+  counter_t address_read_ctr{ 0 };
+  counter_t set_ptr_ctr{ 0 };
+  counter_t set_ptr_ns{ 0 };
+  counter_t set_ptr_max_ns{ 0 };
+  counter_t lost_block_ctr{ 0 };
+  counter_t ring_full_ctr{ 0 };
+  counter_t lease_hold_ctr{ 0 }; // dispatches that kept the read pointer before held blocks
+  counter_t held_blocks_max{ 0 };
+  counter_t set_ptr_interval_ns{ 0 };
+  counter_t set_ptr_interval_max_ns{ 0 };
+  counter_t occupancy_bytes{ 0 }; // gauge, at the last dispatch
+  counter_t occupancy_max_bytes{ 0 };
+  counter_t wait_ns{ 0 };
+  counter_t dispatch_ns{ 0 };
+  // Blocks handed out per dispatch: 1, 2-7, 8-63, 64-511, 512 and more
+  std::array<counter_t, 5> batch_hist{};
+};
+
+inline size_t
+batch_hist_bucket(size_t blocks)
+{
+  if (blocks < 2) {
+    return 0;
+  }
+  size_t bucket = 1 + (63 - __builtin_clzll(blocks)) / 3;
+  return bucket < 4 ? bucket : 4;
+}
+
+struct DispatcherStats
+{
+  counter_t wakeup_ctr{ 0 };
+  counter_t event_ctr{ 0 };
+  counter_t dispatch_ctr{ 0 };
+};
+
+struct ParserWorkerStats
+{
+  counter_t block_ctr{ 0 };
+  counter_t stolen_block_ctr{ 0 };
+  counter_t steal_ctr{ 0 };
+  counter_t idle_wait_ctr{ 0 };
+  counter_t park_ctr{ 0 };
+};
+
+struct CardLockStats
+{
+  counter_t lock_ctr{ 0 };
+  counter_t contended_ctr{ 0 };
+  counter_t wait_ns{ 0 };
+  counter_t wait_max_ns{ 0 };
+};
+
+inline void
+update_max(counter_t& max, uint64_t value) // NOLINT(build/unsigned)
+{
+  uint64_t prev = max.load(std::memory_order_relaxed); // NOLINT(build/unsigned)
+  while (prev < value && !max.compare_exchange_weak(prev, value, std::memory_order_relaxed)) {
+  }
+}
+
 } // namespace dunedaq::flxlibs::stats
 
 #endif // FLXLIBS_SRC_FELIXSTATISTICS_HPP_
@@ -0,0 +1,116 @@
+/**
+ * @file FlxCardBackend.cpp CardBackend on top of FELIX's FlxCard and CMEM_RCC
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+// From Module
+#include "FlxCardBackend.hpp"
+#include "FelixIssues.hpp"
+
+#include "flxcard/FlxException.h"
+#include "logging/Logging.hpp"
+
+// From STD
+#include <memory>
+#include <string>
+
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace dunedaq {
+namespace flxlibs {
+
+FlxCardBackend::FlxCardBackend()
+{
+  m_flx_card = std::make_unique<FlxCard>();
+  if (m_flx_card == nullptr) {
+    ers::fatal(flxlibs::CardError(ERS_HERE, "Couldn't create FlxCard object."));
+  }
+}
+
+void
+FlxCardBackend::card_open(int absolute_card_id)
+{
+  m_flx_card->card_open(absolute_card_id, LOCK_NONE); // FlxCard.h
+}
+
+FlxCardBackend::~FlxCardBackend()
+{
+  stop_interrupt_bridges();
+}
+
+void
+FlxCardBackend::card_close()
+{
+  stop_interrupt_bridges();
+  m_flx_card->card_close();
+}
+
+bool
+FlxCardBackend::tohost_busy_latched()
+{
+  if (!m_busy_status_available) {
+    return false;
+  }
+  // Not every firmware flavour has the busy status bitfields
+  try {
+    bool busy = m_flx_card->cfg_get_option("DMA_BUSY_STATUS_TOHOST_BUSY_LATCHED", false) != 0;
+    if (busy) {
+      m_flx_card->cfg_set_option("DMA_BUSY_STATUS_CLEAR_LATCH", 1, false);
+      m_flx_card->cfg_set_option("DMA_BUSY_STATUS_CLEAR_LATCH", 0, false);
+    }
+    return busy;
+  } catch (FlxException& ex) {
+    TLOG() << "To-host busy status not available, overruns are only detected in software: " << ex.what();
+    m_busy_status_available = false;
+    return false;
+  }
+}
+
+int
+FlxCardBackend::interrupt_fd(unsigned irq)
+{
+  auto it = m_interrupt_bridges.find(irq);
+  if (it != m_interrupt_bridges.end()) {
+    return it->second.fd;
+  }
+  auto& bridge = m_interrupt_bridges[irq];
+  bridge.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (bridge.fd < 0) {
+    m_interrupt_bridges.erase(irq);
+    return -1;
+  }
+  m_bridges_running.store(true);
+  int fd = bridge.fd;
+  bridge.waiter = std::thread([this, irq, fd]() {
+    uint64_t one = 1; // NOLINT(build/unsigned)
+    while (m_bridges_running.load()) {
+      m_flx_card->irq_wait(irq);
+      if (m_bridges_running.load()) {
+        [[maybe_unused]] auto ret = write(fd, &one, sizeof(one));
+      }
+    }
+  });
+  pthread_setname_np(bridge.waiter.native_handle(), ("flx-irq-wait-" + std::to_string(irq)).substr(0, 15).c_str());
+  return bridge.fd;
+}
+
+void
+FlxCardBackend::stop_interrupt_bridges()
+{
+  m_bridges_running.store(false);
+  for (auto& [irq, bridge] : m_interrupt_bridges) {
+    m_flx_card->irq_cancel(irq);
+    if (bridge.waiter.joinable()) {
+      bridge.waiter.join();
+    }
+    close(bridge.fd);
+  }
+  m_interrupt_bridges.clear();
+}
+
+} // namespace flxlibs
+} // namespace dunedaq
@@ -0,0 +1,76 @@
+/**
+ * @file FlxCardBackend.hpp CardBackend on top of FELIX's FlxCard and CMEM_RCC
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef FLXLIBS_SRC_FLXCARDBACKEND_HPP_
+#define FLXLIBS_SRC_FLXCARDBACKEND_HPP_
+
+#include "CardBackend.hpp"
+
+#include "flxcard/FlxCard.h"
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <thread>
+
+namespace dunedaq::flxlibs {
+
+class FlxCardBackend : public CardBackend
+{
+public:
+  FlxCardBackend();
+  ~FlxCardBackend();
+
+  void card_open(int absolute_card_id) override;
+  void card_close() override;
+  bool virtual_dma_addresses() const override { return false; }
+
+  void dma_reset() override { m_flx_card->dma_reset(); }
+  void soft_reset() override { m_flx_card->soft_reset(); }
+  void irq_reset_counters() override { m_flx_card->irq_reset_counters(); }
+  void irq_enable(unsigned irq) override { m_flx_card->irq_enable(irq); }
+  void irq_disable() override { m_flx_card->irq_disable(); }
+  void irq_wait(unsigned irq) override { m_flx_card->irq_wait(irq); }
+  void irq_cancel(unsigned irq) override { m_flx_card->irq_cancel(irq); }
+  int interrupt_fd(unsigned irq) override;
+
+  void dma_to_host(unsigned dma_id, u_long paddr, u_long size, unsigned flags) override // NOLINT
+  {
+    m_flx_card->dma_to_host(dma_id, paddr, size, flags); // FlxCard.h
+  }
+  void dma_stop(unsigned dma_id) override { m_flx_card->dma_stop(dma_id); }
+  // Plain MMIO accesses to the mapped BAR0 registers of the descriptor
+  void dma_set_ptr(unsigned dma_id, u_long paddr) override // NOLINT
+  {
+    m_flx_card->m_bar0->DMA_DESC[dma_id].read_ptr = paddr;
+  }
+  uint64_t current_address(unsigned dma_id) override // NOLINT
+  {
+    return m_flx_card->m_bar0->DMA_DESC_STATUS[dma_id].current_address;
+  }
+  bool tohost_busy_latched() override;
+
+private:
+  using UniqueFlxCard = std::unique_ptr<FlxCard>;
+  UniqueFlxCard m_flx_card;
+  bool m_busy_status_available{ true };
+
+  // The driver only offers a blocking wait per interrupt. A bridge thread per interrupt
+  // waits in irq_wait and forwards every interrupt to an eventfd.
+  struct InterruptBridge
+  {
+    int fd{ -1 };
+    std::thread waiter;
+  };
+  void stop_interrupt_bridges();
+  std::atomic<bool> m_bridges_running{ false };
+  std::map<unsigned, InterruptBridge> m_interrupt_bridges;
+};
+
+} // namespace dunedaq::flxlibs
+
+#endif // FLXLIBS_SRC_FLXCARDBACKEND_HPP_
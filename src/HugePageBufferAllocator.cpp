@@ -0,0 +1,92 @@
+/**
+ * @file HugePageBufferAllocator.cpp DMA buffers in hugetlbfs backed anonymous memory
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+// From Module
+#include "HugePageBufferAllocator.hpp"
+#include "FelixIssues.hpp"
+
+#include "logging/Logging.hpp"
+
+// From STD
+#include <array>
+#include <string>
+
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26 // NOLINT(build/define_used)
+#endif
+
+namespace dunedaq {
+namespace flxlibs {
+
+HugePageBufferAllocator::HugePageBufferAllocator(size_t page_size, size_t prefault_threads)
+  : m_page_size(page_size)
+  , m_prefault_threads(prefault_threads)
+{}
+
+std::string
+HugePageBufferAllocator::name() const
+{
+  return (m_page_size >= (1UL << 30)) ? "hugepage_1g" : "hugepage_2m";
+}
+
+bool
+HugePageBufferAllocator::allocate(uint8_t numa, size_t size, DmaBuffer& buffer) // NOLINT(build/unsigned)
+{
+  // Without NUMA support the kernel has no node directories, and only node 0
+  if (numa != 0 && access(("/sys/devices/system/node/node" + std::to_string(numa)).c_str(), F_OK) != 0) {
+    TLOG() << "NUMA node " << std::to_string(numa) << " doesn't exist, no DMA buffer allocated on it.";
+    return false;
+  }
+  size = (size + m_page_size - 1) / m_page_size * m_page_size;
+  int huge_flags = MAP_HUGETLB | (__builtin_ctzl(m_page_size) << MAP_HUGE_SHIFT);
+  void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | huge_flags, -1, 0);
+  if (addr == MAP_FAILED) {
+    TLOG() << "Not enough " << m_page_size / 1024 << " kB huge pages for a DMA buffer of " << size
+           << " Bytes, falling back to regular pages.";
+    addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+      return false;
+    }
+    madvise(addr, size, MADV_HUGEPAGE);
+  }
+  // Bind before the first touch, the prefault then places every page on the node
+  // One bit for every node an uint8_t can name. The kernel reads one bit less than maxnode.
+  constexpr size_t mask_word_bits = sizeof(unsigned long) * 8; // NOLINT(runtime/int)
+  std::array<unsigned long, 256 / mask_word_bits> nodemask{}; // NOLINT(runtime/int)
+  nodemask[numa / mask_word_bits] = 1UL << (numa % mask_word_bits);
+  const size_t maxnode = nodemask.size() * mask_word_bits + 1;
+  if (syscall(SYS_mbind, addr, size, MPOL_BIND, nodemask.data(), maxnode, 0) != 0) {
+    TLOG() << "Couldn't bind DMA buffer to NUMA node " << std::to_string(numa) << ", using the default policy.";
+  }
+
+  buffer.handle = m_next_handle++;
+  buffer.vaddr = reinterpret_cast<u_long>(addr); // NOLINT
+  buffer.paddr = buffer.vaddr;
+  buffer.size = size;
+  buffer.page_size = query_page_size(addr);
+  prefault(addr, size, buffer.page_size, m_prefault_threads);
+  // The node is known once pages are present
+  buffer.numa_node = query_numa_node(addr);
+  return true;
+}
+
+void
+HugePageBufferAllocator::release(DmaBuffer& buffer)
+{
+  if (buffer.vaddr != 0) {
+    munmap(reinterpret_cast<void*>(buffer.vaddr), buffer.size); // NOLINT
+  }
+  buffer = DmaBuffer();
+}
+
+} // namespace flxlibs
+} // namespace dunedaq
@@ -0,0 +1,41 @@
+/**
+ * @file HugePageBufferAllocator.hpp DMA buffers in hugetlbfs backed anonymous memory
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef FLXLIBS_SRC_HUGEPAGEBUFFERALLOCATOR_HPP_
+#define FLXLIBS_SRC_HUGEPAGEBUFFERALLOCATOR_HPP_
+
+#include "DmaBufferAllocator.hpp"
+
+#include <string>
+
+namespace dunedaq::flxlibs {
+
+/**
+ * @brief DMA buffers mmap-ed from the 1 GiB or 2 MiB hugetlbfs pool and bound to
+ * the NUMA node. Falls back to regular pages with transparent huge pages if the
+ * pool is too small. The addresses are virtual, so these buffers only serve
+ * software card backends and replay, not a FELIX card.
+ */
+class HugePageBufferAllocator : public DmaBufferAllocator
+{
+public:
+  HugePageBufferAllocator(size_t page_size, size_t prefault_threads);
+
+  std::string name() const override;
+  bool allocate(uint8_t numa, size_t size, DmaBuffer& buffer) override; // NOLINT(build/unsigned)
+  void release(DmaBuffer& buffer) override;
+  bool virtual_dma_addresses() const override { return true; }
+
+private:
+  size_t m_page_size;
+  size_t m_prefault_threads;
+  int m_next_handle{ 0 };
+};
+
+} // namespace dunedaq::flxlibs
+
+#endif // FLXLIBS_SRC_HUGEPAGEBUFFERALLOCATOR_HPP_
@@ -0,0 +1,209 @@
+/**
+ * @file InterruptDispatcher.cpp Interrupt dispatcher implementation
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+// From Module
+#include "InterruptDispatcher.hpp"
+#include "FelixIssues.hpp"
+#include "ThreadAffinity.hpp"
+
+#include "logging/Logging.hpp"
+
+// From STD
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/**
+ * @brief TRACE debug levels used in this source file
+ */
+enum
+{
+  TLVL_ENTER_EXIT_METHODS = 5,
+  TLVL_WORK_STEPS = 10,
+  TLVL_BOOKKEEPING = 15
+};
+
+namespace dunedaq {
+namespace flxlibs {
+
+namespace {
+constexpr int s_max_events = 64;
+constexpr int s_epoll_timeout_ms = 100;
+} // namespace
+
+InterruptDispatcher::InterruptDispatcher(size_t num_workers, const std::string& name, const std::vector<int>& cpus)
+  : m_cpus(cpus)
+{
+  m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  m_wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (m_epoll_fd < 0 || m_wakeup_fd < 0) {
+    ers::fatal(InitializationError(ERS_HERE, "Interrupt dispatcher can't create epoll/eventfd: " +
+                                               std::string(std::strerror(errno))));
+  }
+  epoll_event ev{};
+  ev.events = EPOLLIN;
+  ev.data.u64 = static_cast<uint64_t>(-1); // NOLINT(build/unsigned)
+  epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_wakeup_fd, &ev);
+
+  m_waiter = std::thread(&InterruptDispatcher::wait_events, this);
+  pthread_setname_np(m_waiter.native_handle(), name.substr(0, 15).c_str());
+  for (size_t i = 0; i < std::max<size_t>(num_workers, 1); ++i) {
+    m_workers.emplace_back(&InterruptDispatcher::run_handlers, this);
+    auto worker_name = name + "-" + std::to_string(i);
+    pthread_setname_np(m_workers.back().native_handle(), worker_name.substr(0, 15).c_str());
+  }
+  TLOG_DEBUG(TLVL_WORK_STEPS) << "Interrupt dispatcher started with " << m_workers.size() << " workers.";
+}
+
+InterruptDispatcher::~InterruptDispatcher()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  uint64_t one = 1; // NOLINT(build/unsigned)
+  [[maybe_unused]] auto ret = write(m_wakeup_fd, &one, sizeof(one));
+  m_queue_cv.notify_all();
+  m_waiter.join();
+  for (auto& worker : m_workers) {
+    worker.join();
+  }
+  close(m_wakeup_fd);
+  close(m_epoll_fd);
+  TLOG_DEBUG(TLVL_WORK_STEPS) << "Interrupt dispatcher stopped.";
+}
+
+std::shared_ptr<InterruptDispatcher>
+InterruptDispatcher::shared(size_t num_workers, const std::vector<int>& cpus)
+{
+  static std::mutex instance_mutex;
+  static std::weak_ptr<InterruptDispatcher> instance;
+  std::lock_guard<std::mutex> lock(instance_mutex);
+  auto dispatcher = instance.lock();
+  if (dispatcher == nullptr) {
+    dispatcher = std::make_shared<InterruptDispatcher>(num_workers, "flx-irq", cpus);
+    instance = dispatcher;
+  } else if (dispatcher->get_num_workers() != num_workers) {
+    TLOG() << "Interrupt dispatcher already runs with " << dispatcher->get_num_workers()
+           << " workers, ignoring the request for " << num_workers << ".";
+  }
+  return dispatcher;
+}
+
+InterruptDispatcher::source_id_t
+InterruptDispatcher::add_source(int event_fd, handler_t handler)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto source = std::make_shared<Source>();
+  source->fd = event_fd;
+  source->handler = std::move(handler);
+  source_id_t id = m_next_id++;
+
+  epoll_event ev{};
+  ev.events = EPOLLIN;
+  ev.data.u64 = static_cast<uint64_t>(id); // NOLINT(build/unsigned)
+  if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, event_fd, &ev) != 0) {
+    ers::error(InitializationError(ERS_HERE, "Interrupt dispatcher can't watch fd " + std::to_string(event_fd) +
+                                               ": " + std::string(std::strerror(errno))));
+    return -1;
+  }
+  m_sources[id] = source;
+  return id;
+}
+
+void
+InterruptDispatcher::remove_source(source_id_t id)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  auto it = m_sources.find(id);
+  if (it == m_sources.end()) {
+    return;
+  }
+  auto source = it->second;
+  m_sources.erase(it);
+  epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, source->fd, nullptr);
+  source->removed = true;
+  m_idle_cv.wait(lock, [&] { return !source->scheduled; });
+}
+
+void
+InterruptDispatcher::wait_events()
+{
+  set_current_thread_affinity(m_cpus);
+  std::array<epoll_event, s_max_events> events;
+  while (true) {
+    int num_events = epoll_wait(m_epoll_fd, events.data(), s_max_events, s_epoll_timeout_ms);
+    if (num_events < 0 && errno != EINTR) {
+      ers::error(CardError(ERS_HERE, "Interrupt dispatcher epoll_wait failed: " + std::string(std::strerror(errno))));
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_stop) {
+      return;
+    }
+    if (num_events <= 0) {
+      continue;
+    }
+    m_stats.wakeup_ctr++;
+    for (int i = 0; i < num_events; ++i) {
+      auto it = m_sources.find(static_cast<source_id_t>(events[i].data.u64));
+      if (it == m_sources.end()) {
+        continue;
+      }
+      auto& source = it->second;
+      // Consume the eventfd counter: all interrupts so far are served by one handler call
+      uint64_t count; // NOLINT(build/unsigned)
+      [[maybe_unused]] auto ret = read(source->fd, &count, sizeof(count));
+      m_stats.event_ctr++;
+      if (source->scheduled) {
+        source->pending = true;
+      } else {
+        source->scheduled = true;
+        m_ready.push_back(source);
+        m_queue_cv.notify_one();
+      }
+    }
+  }
+}
+
+void
+InterruptDispatcher::run_handlers()
+{
+  set_current_thread_affinity(m_cpus);
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true) {
+    m_queue_cv.wait(lock, [&] { return m_stop || !m_ready.empty(); });
+    if (m_stop) {
+      return;
+    }
+    auto source = m_ready.front();
+    m_ready.pop_front();
+    if (!source->removed) {
+      lock.unlock();
+      source->handler();
+      m_stats.dispatch_ctr++;
+      lock.lock();
+    }
+    if (source->pending && !source->removed) {
+      source->pending = false;
+      m_ready.push_back(source);
+    } else {
+      source->scheduled = false;
+      m_idle_cv.notify_all();
+    }
+  }
+}
+
+} // namespace flxlibs
+} // namespace dunedaq
@@ -0,0 +1,97 @@
+/**
+ * @file InterruptDispatcher.hpp Waits on many interrupt sources from one thread
+ * and runs their handlers on a small thread pool
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef FLXLIBS_SRC_INTERRUPTDISPATCHER_HPP_
+#define FLXLIBS_SRC_INTERRUPTDISPATCHER_HPP_
+
+#include "FelixStatistics.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace dunedaq::flxlibs {
+
+/**
+ * @brief An interrupt source is an eventfd that is written when the interrupt fires.
+ * One thread waits on all registered sources with epoll and hands the ready ones to
+ * a pool of worker threads, that call the handlers of the sources. A handler never
+ * runs concurrently with itself: interrupts of a source that is queued or running
+ * are combined into one more handler call after the current one.
+ *
+ * Card readers of the same application share one dispatcher, see shared().
+ */
+class InterruptDispatcher
+{
+public:
+  using handler_t = std::function<void()>;
+  using source_id_t = int;
+
+  explicit InterruptDispatcher(size_t num_workers,
+                               const std::string& name = "flx-irq",
+                               const std::vector<int>& cpus = {});
+  ~InterruptDispatcher();
+  InterruptDispatcher(const InterruptDispatcher&) = delete;            ///< Not copy-constructible
+  InterruptDispatcher& operator=(const InterruptDispatcher&) = delete; ///< Not copy-assignable
+  InterruptDispatcher(InterruptDispatcher&&) = delete;                 ///< Not move-constructible
+  InterruptDispatcher& operator=(InterruptDispatcher&&) = delete;      ///< Not move-assignable
+
+  // Dispatcher of the process, created with num_workers on cpus by the first caller
+  // and destroyed when the last user releases it.
+  static std::shared_ptr<InterruptDispatcher> shared(size_t num_workers, const std::vector<int>& cpus = {});
+
+  // Starts calling handler when event_fd becomes readable. The dispatcher doesn't own the fd.
+  source_id_t add_source(int event_fd, handler_t handler);
+  // Stops dispatching the source. Returns after a running handler call of the source finished.
+  void remove_source(source_id_t id);
+
+  size_t get_num_workers() const { return m_workers.size(); }
+  uint64_t get_num_wakeups() const { return m_stats.wakeup_ctr.load(); }   // NOLINT(build/unsigned)
+  uint64_t get_num_events() const { return m_stats.event_ctr.load(); }     // NOLINT(build/unsigned)
+  uint64_t get_num_dispatches() const { return m_stats.dispatch_ctr.load(); } // NOLINT(build/unsigned)
+
+private:
+  struct Source
+  {
+    int fd;
+    handler_t handler;
+    bool scheduled{ false }; // queued or running
+    bool pending{ false };   // fired again while scheduled
+    bool removed{ false };
+  };
+
+  void wait_events();
+  void run_handlers();
+
+  std::vector<int> m_cpus;
+
+  int m_epoll_fd{ -1 };
+  int m_wakeup_fd{ -1 };
+  bool m_stop{ false };
+
+  std::mutex m_mutex;
+  std::condition_variable m_queue_cv;
+  std::condition_variable m_idle_cv;
+  std::map<source_id_t, std::shared_ptr<Source>> m_sources;
+  std::deque<std::shared_ptr<Source>> m_ready;
+  source_id_t m_next_id{ 0 };
+
+  std::thread m_waiter;
+  std::vector<std::thread> m_workers;
+  stats::DispatcherStats m_stats;
+};
+
+} // namespace dunedaq::flxlibs
+
+#endif // FLXLIBS_SRC_INTERRUPTDISPATCHER_HPP_
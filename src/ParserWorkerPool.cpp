@@ -0,0 +1,256 @@
+/**
+ * @file ParserWorkerPool.cpp Parser worker pool implementation
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+// From Module
+#include "ParserWorkerPool.hpp"
+#include "ElinkConcept.hpp"
+#include "PollBackoff.hpp"
+#include "ThreadAffinity.hpp"
+
+#include "flxlibs/felixcardreaderinfo/InfoNljs.hpp"
+#include "logging/Logging.hpp"
+
+// From STD
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include <pthread.h>
+#include <sched.h>
+
+/**
+ * @brief TRACE debug levels used in this source file
+ */
+enum
+{
+  TLVL_ENTER_EXIT_METHODS = 5,
+  TLVL_WORK_STEPS = 10,
+  TLVL_BOOKKEEPING = 15
+};
+
+namespace dunedaq {
+namespace flxlibs {
+
+namespace {
+constexpr size_t s_cpu_sample_interval = 1024;
+// Parks end at the latest after this, a lost wakeup can't stall an elink for longer
+constexpr std::chrono::microseconds s_max_park{ 100000 };
+} // namespace
+
+ParserWorkerPool::ParserWorkerPool(const std::vector<ElinkConcept*>& elinks,
+                                   size_t num_workers,
+                                   size_t batch_blocks,
+                                   size_t spin_count,
+                                   size_t yield_count,
+                                   const std::vector<std::vector<int>>& worker_cpus,
+                                   int card_id,
+                                   int logical_unit)
+  : m_batch_blocks(std::max<size_t>(batch_blocks, 1))
+  , m_spin_count(spin_count)
+  , m_yield_count(yield_count)
+  , m_card_id(card_id)
+  , m_logical_unit(logical_unit)
+{
+  num_workers = std::max<size_t>(num_workers, 1);
+  for (size_t i = 0; i < num_workers; ++i) {
+    m_workers.push_back(std::make_unique<Worker>());
+    m_workers.back()->index = i;
+    if (i < worker_cpus.size()) {
+      m_workers.back()->cpus = worker_cpus[i];
+    }
+  }
+  // Elinks are dealt to the workers round robin, in the order given
+  for (size_t i = 0; i < elinks.size(); ++i) {
+    auto task = std::make_unique<Task>();
+    task->elink = elinks[i];
+    task->home = i % num_workers;
+    m_workers[task->home]->home_tasks.push_back(task.get());
+    m_task_of_elink[elinks[i]] = task.get();
+    m_tasks.push_back(std::move(task));
+  }
+
+  for (size_t i = 0; i < num_workers; ++i) {
+    auto& worker = *m_workers[i];
+    worker.thread = std::thread(&ParserWorkerPool::run_worker, this, std::ref(worker));
+    auto name = "flx-prs-" + std::to_string(m_card_id) + "-" + std::to_string(m_logical_unit) + "-" + std::to_string(i);
+    pthread_setname_np(worker.thread.native_handle(), name.substr(0, 15).c_str());
+  }
+  TLOG_DEBUG(TLVL_WORK_STEPS) << "Parser worker pool of card " << m_card_id << " started with " << num_workers
+                              << " workers for " << elinks.size() << " elinks.";
+}
+
+ParserWorkerPool::~ParserWorkerPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_cv.notify_all();
+  m_waiter.wake();
+  for (auto& worker : m_workers) {
+    worker->thread.join();
+  }
+  TLOG_DEBUG(TLVL_WORK_STEPS) << "Parser worker pool of card " << m_card_id << " stopped.";
+}
+
+void
+ParserWorkerPool::attach(ElinkConcept* elink)
+{
+  auto task = m_task_of_elink.find(elink);
+  if (task == m_task_of_elink.end() || task->second->active.exchange(true)) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_num_attached;
+  }
+  m_cv.notify_all();
+}
+
+void
+ParserWorkerPool::detach(ElinkConcept* elink)
+{
+  auto task = m_task_of_elink.find(elink);
+  if (task == m_task_of_elink.end() || !task->second->active.exchange(false)) {
+    return;
+  }
+  // A worker checks active after taking ownership, no batch starts once this wait ends
+  while (task->second->owned.load()) {
+    std::this_thread::yield();
+  }
+  --m_num_attached;
+}
+
+size_t
+ParserWorkerPool::run_batch(Task& task)
+{
+  if (task.owned.load(std::memory_order_relaxed) || task.owned.exchange(true)) {
+    return 0;
+  }
+  size_t parsed = 0;
+  if (task.active.load()) {
+    parsed = task.elink->parse_queued_blocks(m_batch_blocks);
+  }
+  task.owned.store(false, std::memory_order_release);
+  return parsed;
+}
+
+size_t
+ParserWorkerPool::steal_batch(const Worker& worker)
+{
+  // The longest queue of the other workers' elinks, if it holds a batch
+  Task* victim = nullptr;
+  size_t longest = m_batch_blocks - 1;
+  for (auto& task : m_tasks) {
+    if (task->home == worker.index || !task->active.load(std::memory_order_relaxed)) {
+      continue;
+    }
+    auto queued = task->elink->queued_blocks();
+    if (queued > longest) {
+      longest = queued;
+      victim = task.get();
+    }
+  }
+  return victim != nullptr ? run_batch(*victim) : 0;
+}
+
+bool
+ParserWorkerPool::has_queued_blocks() const
+{
+  for (const auto& task : m_tasks) {
+    if (task->active.load(std::memory_order_relaxed) && task->elink->queued_blocks() != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void
+ParserWorkerPool::run_worker(Worker& worker)
+{
+  if (!set_current_thread_affinity(worker.cpus)) {
+    TLOG() << "Couldn't pin parser worker of card " << m_card_id << " to CPUs " << cpus_to_string(worker.cpus);
+  }
+  worker.cpu.store(sched_getcpu(), std::memory_order_relaxed);
+  PollBackoff backoff;
+  backoff.configure(m_spin_count, m_yield_count, 1, 1);
+  size_t blocks = 0;
+  while (!m_stop.load(std::memory_order_relaxed)) {
+    if (m_num_attached.load(std::memory_order_relaxed) == 0) {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cv.wait(lock, [this] { return m_stop.load() || m_num_attached.load() > 0; });
+      backoff.reset();
+      continue;
+    }
+
+    size_t parsed = 0;
+    for (auto* task : worker.home_tasks) {
+      parsed += run_batch(*task);
+    }
+    if (parsed == 0) {
+      parsed = steal_batch(worker);
+      if (parsed != 0) {
+        worker.stats.stolen_block_ctr += parsed;
+        worker.stats.steal_ctr++;
+      }
+    }
+
+    if (parsed != 0) {
+      worker.stats.block_ctr += parsed;
+      if ((blocks += parsed) >= s_cpu_sample_interval) {
+        blocks = 0;
+        worker.cpu.store(sched_getcpu(), std::memory_order_relaxed);
+      }
+      backoff.reset();
+    } else if (!backoff.spun_out()) {
+      worker.stats.idle_wait_ctr++;
+      backoff.wait();
+    } else {
+      worker.stats.park_ctr++;
+      m_waiter.park([this] { return m_stop.load() || m_num_attached.load() == 0 || has_queued_blocks(); }, s_max_park);
+      backoff.reset();
+    }
+  }
+}
+
+uint64_t // NOLINT(build/unsigned)
+ParserWorkerPool::get_num_blocks_stolen() const
+{
+  uint64_t stolen = 0; // NOLINT(build/unsigned)
+  for (const auto& worker : m_workers) {
+    stolen += worker->stats.stolen_block_ctr.load();
+  }
+  return stolen;
+}
+
+void
+ParserWorkerPool::get_info(opmonlib::InfoCollector& ci, int /*level*/)
+{
+  for (size_t i = 0; i < m_workers.size(); ++i) {
+    auto& worker = *m_workers[i];
+    felixcardreaderinfo::ParserWorkerInfo info;
+    info.card_id = m_card_id;
+    info.logical_unit = m_logical_unit;
+    info.worker = i;
+    info.cpu = worker.cpu.load();
+    info.num_elinks = worker.home_tasks.size();
+    info.num_blocks_parsed = worker.stats.block_ctr.exchange(0);
+    info.num_blocks_stolen = worker.stats.stolen_block_ctr.exchange(0);
+    info.num_steals = worker.stats.steal_ctr.exchange(0);
+    info.num_idle_waits = worker.stats.idle_wait_ctr.exchange(0);
+    info.num_parks = worker.stats.park_ctr.exchange(0);
+    opmonlib::InfoCollector child_ci;
+    child_ci.add(info);
+    ci.add("parser_worker_" + std::to_string(m_card_id) + "_" + std::to_string(m_logical_unit) + "_" +
+             std::to_string(i),
+           child_ci);
+  }
+}
+
+} // namespace flxlibs
+} // namespace dunedaq
@@ -0,0 +1,113 @@
+/**
+ * @file ParserWorkerPool.hpp Parses the block queues of all elinks of a card
+ * with a fixed number of worker threads
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef FLXLIBS_SRC_PARSERWORKERPOOL_HPP_
+#define FLXLIBS_SRC_PARSERWORKERPOOL_HPP_
+
+#include "FelixStatistics.hpp"
+#include "QueueWaiter.hpp"
+
+#include "opmonlib/InfoCollector.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace dunedaq::flxlibs {
+
+class ElinkConcept;
+
+/**
+ * @brief Every elink has a home worker, that parses its queue in batches of at most
+ * batch_blocks blocks. A worker that finds no blocks on its own elinks steals one
+ * batch from the elink of another worker with the longest queue, if that queue holds
+ * a batch or more. An elink is parsed by one worker at a time: a worker owns it
+ * for the duration of a batch, so blocks and chunks keep their order. Idle workers
+ * spin, yield and then park on one waiter that the routers of the elinks notify.
+ *
+ * Elinks are fixed at construction. They are only parsed between attach() and detach().
+ */
+class ParserWorkerPool
+{
+public:
+  ParserWorkerPool(const std::vector<ElinkConcept*>& elinks,
+                   size_t num_workers,
+                   size_t batch_blocks,
+                   size_t spin_count,
+                   size_t yield_count,
+                   const std::vector<std::vector<int>>& worker_cpus,
+                   int card_id,
+                   int logical_unit);
+  ~ParserWorkerPool();
+  ParserWorkerPool(const ParserWorkerPool&) = delete;            ///< Not copy-constructible
+  ParserWorkerPool& operator=(const ParserWorkerPool&) = delete; ///< Not copy-assignable
+  ParserWorkerPool(ParserWorkerPool&&) = delete;                 ///< Not move-constructible
+  ParserWorkerPool& operator=(ParserWorkerPool&&) = delete;      ///< Not move-assignable
+
+  // Starts parsing the queue of the elink
+  void attach(ElinkConcept* elink);
+  // Stops parsing the queue of the elink. Returns after a running batch of the elink finished.
+  void detach(ElinkConcept* elink);
+
+  // Waiter the routers notify for the elinks of the pool
+  QueueWaiter& get_waiter() { return m_waiter; }
+
+  size_t get_num_workers() const { return m_workers.size(); }
+  uint64_t get_num_blocks_stolen() const; // NOLINT(build/unsigned)
+  void get_info(opmonlib::InfoCollector& ci, int level);
+
+private:
+  struct alignas(64) Task
+  {
+    ElinkConcept* elink{ nullptr };
+    size_t home{ 0 };
+    std::atomic<bool> active{ false };
+    std::atomic<bool> owned{ false };
+  };
+
+  struct alignas(64) Worker
+  {
+    size_t index{ 0 };
+    std::thread thread;
+    std::vector<int> cpus;
+    std::vector<Task*> home_tasks;
+    std::atomic<int> cpu{ -1 };
+    stats::ParserWorkerStats stats;
+  };
+
+  void run_worker(Worker& worker);
+  size_t run_batch(Task& task);
+  size_t steal_batch(const Worker& worker);
+  bool has_queued_blocks() const;
+
+  size_t m_batch_blocks;
+  size_t m_spin_count;
+  size_t m_yield_count;
+  int m_card_id;
+  int m_logical_unit;
+
+  std::vector<std::unique_ptr<Task>> m_tasks;
+  std::map<const ElinkConcept*, Task*> m_task_of_elink;
+  std::vector<std::unique_ptr<Worker>> m_workers;
+
+  // Workers park while no elink is attached
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  std::atomic<size_t> m_num_attached{ 0 };
+  std::atomic<bool> m_stop{ false };
+  QueueWaiter m_waiter;
+};
+
+} // namespace dunedaq::flxlibs
+
+#endif // FLXLIBS_SRC_PARSERWORKERPOOL_HPP_
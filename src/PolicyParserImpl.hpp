@@ -0,0 +1,128 @@
+/**
+ * @file PolicyParserImpl.hpp FELIX's packetformat block/chunk parser with its
+ * handlers fixed at compile time
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef FLXLIBS_SRC_POLICYPARSERIMPL_HPP_
+#define FLXLIBS_SRC_POLICYPARSERIMPL_HPP_
+
+// 3rdparty, external
+#include "packetformat/block_format.hpp"
+#include "packetformat/block_parser.hpp"
+
+#include "FelixStatistics.hpp"
+#include "flxlibs/AvailableParserOperations.hpp"
+
+namespace dunedaq::flxlibs {
+
+/**
+ * @brief Parser operations whose handlers are policy types, see parsers::FixsizedChunkInto
+ * and friends. The class is final, so BlockParser<PolicyParserImpl<...>> calls the
+ * operations directly and inlines the handlers; a parsers::Discard handler costs nothing.
+ * Counts the same statistics as DefaultParserImpl, which stays the parser for handlers
+ * that are bound at runtime.
+ */
+template<class ChunkPolicy,
+         class ShortchunkPolicy = parsers::Discard,
+         class BlockPolicy = parsers::Discard,
+         class ErrorChunkPolicy = parsers::Discard>
+class PolicyParserImpl final : public felix::packetformat::ParserOperations
+{
+public:
+  PolicyParserImpl() = default;
+  PolicyParserImpl(const PolicyParserImpl&) = delete;            ///< PolicyParserImpl is not copy-constructible
+  PolicyParserImpl& operator=(const PolicyParserImpl&) = delete; ///< PolicyParserImpl is not copy-assignable
+  PolicyParserImpl(PolicyParserImpl&&) = delete;                 ///< PolicyParserImpl is not move-constructible
+  PolicyParserImpl& operator=(PolicyParserImpl&&) = delete;      ///< PolicyParserImpl is not move-assignable
+
+  stats::ParserStats& get_stats() { return m_stats; }
+
+  // Handlers, e.g. to set their sinks before the first block
+  ChunkPolicy& chunk_policy() { return m_chunk_policy; }
+  ShortchunkPolicy& shortchunk_policy() { return m_shortchunk_policy; }
+  BlockPolicy& block_policy() { return m_block_policy; }
+  ErrorChunkPolicy& error_chunk_policy() { return m_error_chunk_policy; }
+
+  // Implementation of ParserOperations
+  void chunk_processed(const felix::packetformat::chunk& chunk) { on_chunk(chunk); }
+
+  void shortchunk_processed(const felix::packetformat::shortchunk& shortchunk)
+  {
+    m_shortchunk_policy(shortchunk);
+    m_stats.short_ctr++;
+  }
+
+  void subchunk_processed(const felix::packetformat::subchunk& /*subchunk*/) { m_stats.subchunk_ctr++; }
+
+  void block_processed(const felix::packetformat::block& block)
+  {
+    m_block_policy(block);
+    m_stats.block_ctr++;
+  }
+
+  void chunk_processed_with_error(const felix::packetformat::chunk& chunk) { on_chunk_with_error(chunk); }
+
+  void subchunk_processed_with_error(const felix::packetformat::subchunk& subchunk)
+  {
+    if (subchunk.crcerr_flag) {
+      m_stats.subchunk_crc_error_ctr++;
+    }
+    if (subchunk.trunc_flag) {
+      m_stats.subchunk_trunc_error_ctr++;
+    }
+    if (subchunk.err_flag) {
+      m_stats.subchunk_error_ctr++;
+    }
+    m_stats.error_subchunk_ctr++;
+  }
+
+  void shortchunk_process_with_error(const felix::packetformat::shortchunk& /*shortchunk*/)
+  {
+    m_stats.error_short_ctr++;
+  }
+
+  void block_processed_with_error(const felix::packetformat::block& /*block*/) { m_stats.error_block_ctr++; }
+
+  // Chunks of other decoders than BlockParser, e.g. BlockDecoder32b
+  template<class Chunk>
+  void chunk_processed(const Chunk& chunk)
+  {
+    on_chunk(chunk);
+  }
+
+  template<class Chunk>
+  void chunk_processed_with_error(const Chunk& chunk)
+  {
+    on_chunk_with_error(chunk);
+  }
+
+private:
+  template<class Chunk>
+  void on_chunk(const Chunk& chunk)
+  {
+    m_chunk_policy(chunk);
+    m_stats.chunk_ctr++;
+  }
+
+  template<class Chunk>
+  void on_chunk_with_error(const Chunk& chunk)
+  {
+    m_error_chunk_policy(chunk);
+    m_stats.error_chunk_ctr++;
+  }
+
+  ChunkPolicy m_chunk_policy;
+  ShortchunkPolicy m_shortchunk_policy;
+  BlockPolicy m_block_policy;
+  ErrorChunkPolicy m_error_chunk_policy;
+
+  // Statistics
+  stats::ParserStats m_stats;
+};
+
+} // namespace dunedaq::flxlibs
+
+#endif // FLXLIBS_SRC_POLICYPARSERIMPL_HPP_
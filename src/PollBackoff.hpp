@@ -0,0 +1,108 @@
+/**
+ * @file PollBackoff.hpp Spin, then yield, then sleep with exponential backoff
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef FLXLIBS_SRC_POLLBACKOFF_HPP_
+#define FLXLIBS_SRC_POLLBACKOFF_HPP_
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+
+namespace dunedaq::flxlibs {
+
+inline void
+cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  _mm_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield" ::: "memory");
+#endif
+}
+
+/**
+ * @brief Waiting strategy for polling loops. The first spin_count waits busy-spin
+ * with a pause instruction, the next yield_count waits yield the CPU, then waits
+ * sleep for min_sleep, doubling up to max_sleep. reset() starts over from spinning,
+ * it is called once the polled condition became true.
+ */
+class PollBackoff
+{
+public:
+  enum class Stage
+  {
+    kSpin = 0,
+    kYield,
+    kSleep
+  };
+
+  void configure(size_t spin_count, size_t yield_count, size_t min_sleep_us, size_t max_sleep_us)
+  {
+    m_spin_count = spin_count;
+    m_yield_count = yield_count;
+    m_min_sleep = std::chrono::microseconds(std::max<size_t>(min_sleep_us, 1));
+    m_max_sleep = std::chrono::microseconds(std::max(min_sleep_us, max_sleep_us));
+    reset();
+  }
+
+  void reset()
+  {
+    m_waits = 0;
+    m_sleep = m_min_sleep;
+  }
+
+  size_t waits() const { return m_waits; }
+
+  // True once the spin and yield waits are used up, for callers that park instead of sleeping
+  bool spun_out() const { return m_waits >= m_spin_count + m_yield_count; }
+
+  // Stage of the last wait. Stage of a wakeup when asked after the condition became true.
+  Stage stage() const
+  {
+    if (m_waits <= m_spin_count) {
+      return Stage::kSpin;
+    } else if (m_waits <= m_spin_count + m_yield_count) {
+      return Stage::kYield;
+    }
+    return Stage::kSleep;
+  }
+
+  // Sleeps are cut to max_sleep, e.g. to meet a deadline
+  void wait(std::chrono::microseconds max_sleep = std::chrono::microseconds::max())
+  {
+    ++m_waits;
+    switch (stage()) {
+      case Stage::kSpin:
+        cpu_relax();
+        break;
+      case Stage::kYield:
+        std::this_thread::yield();
+        break;
+      case Stage::kSleep:
+        std::this_thread::sleep_for(std::min(m_sleep, max_sleep));
+        m_sleep = std::min(m_sleep * 2, m_max_sleep);
+        break;
+    }
+  }
+
+private:
+  size_t m_spin_count{ 0 };
+  size_t m_yield_count{ 0 };
+  std::chrono::microseconds m_min_sleep{ 1 };
+  std::chrono::microseconds m_max_sleep{ 1 };
+  size_t m_waits{ 0 };
+  std::chrono::microseconds m_sleep{ 1 };
+};
+
+} // namespace dunedaq::flxlibs
+
+#endif // FLXLIBS_SRC_POLLBACKOFF_HPP_
@@ -0,0 +1,76 @@
+/**
+ * @file QueueWaiter.hpp Parks the consumers of lock-free queues on a futex until a
+ * producer published new entries
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef FLXLIBS_SRC_QUEUEWAITER_HPP_
+#define FLXLIBS_SRC_QUEUEWAITER_HPP_
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace dunedaq::flxlibs {
+
+/**
+ * @brief A consumer that found its queue empty parks with park(), after re-checking the
+ * queue. A producer calls notify() after a memory fence that follows its queue writes,
+ * which costs one relaxed load while nobody is parked. One fence may cover the writes to
+ * many queues, e.g. a span of blocks routed to many elinks.
+ *
+ * The consumer announces itself before its last check of the queue, and the producer
+ * checks for parked consumers after its fence: either the consumer sees the new entries,
+ * or the producer sees the consumer and bumps the futex word before or while it sleeps.
+ */
+class QueueWaiter
+{
+public:
+  // Parks the caller until notify() or wake(), unless has_data() is true after announcing
+  // itself. Returns false if the wait timed out.
+  template<typename Predicate>
+  bool park(Predicate&& has_data, std::chrono::microseconds timeout)
+  {
+    uint32_t seq = m_seq.load(); // NOLINT(build/unsigned)
+    m_parked.fetch_add(1);
+    bool woken = true;
+    if (!has_data()) {
+      timespec ts{ static_cast<time_t>(timeout.count() / 1000000), static_cast<long>(timeout.count() % 1000000) * 1000 }; // NOLINT
+      woken = !(syscall(SYS_futex, &m_seq, FUTEX_WAIT_PRIVATE, seq, &ts, nullptr, 0) != 0 && errno == ETIMEDOUT);
+    }
+    m_parked.fetch_sub(1);
+    return woken;
+  }
+
+  // Producer side, after std::atomic_thread_fence(std::memory_order_seq_cst)
+  void notify()
+  {
+    if (m_parked.load(std::memory_order_relaxed) != 0) {
+      wake();
+    }
+  }
+
+  // Wakes all parked consumers, e.g. to stop them
+  void wake()
+  {
+    m_seq.fetch_add(1);
+    syscall(SYS_futex, &m_seq, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+  }
+
+private:
+  alignas(64) std::atomic<uint32_t> m_seq{ 0 }; // NOLINT(build/unsigned)
+  std::atomic<uint32_t> m_parked{ 0 };          // NOLINT(build/unsigned)
+};
+
+} // namespace dunedaq::flxlibs
+
+#endif // FLXLIBS_SRC_QUEUEWAITER_HPP_
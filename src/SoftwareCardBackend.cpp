@@ -0,0 +1,331 @@
+/**
+ * @file SoftwareCardBackend.cpp Software emulation of a FELIX card's to-host DMA
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+// From Module
+#include "SoftwareCardBackend.hpp"
+#include "FelixBlockFormat.hpp"
+#include "FelixDefinitions.hpp"
+#include "FelixIssues.hpp"
+
+#include "logging/Logging.hpp"
+
+#include "packetformat/block_format.hpp"
+
+// From STD
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/**
+ * @brief TRACE debug levels used in this source file
+ */
+enum
+{
+  TLVL_ENTER_EXIT_METHODS = 5,
+  TLVL_WORK_STEPS = 10,
+  TLVL_BOOKKEEPING = 15
+};
+
+namespace dunedaq {
+namespace flxlibs {
+
+SoftwareCardBackend::SoftwareCardBackend(const felixcardreader::Conf& cfg)
+  : m_block_size(cfg.dma_block_size_kb * 1024UL)
+  , m_trailer_size(cfg.chunk_trailer_size == 32 ? 4 : 2)
+  , m_max_subchunk_length(cfg.chunk_trailer_size == 32 ? 0xFFFF : 0x3FF)
+  , m_chunk_size(cfg.sw_chunk_size)
+  , m_block_rate(cfg.sw_block_rate)
+  , m_irq_wait_timeout(cfg.sw_irq_wait_timeout)
+{
+  if (cfg.sw_elinks.empty() || m_chunk_size == 0) {
+    ers::fatal(ConfigurationError(ERS_HERE, "Software card backend needs at least one elink and a non-zero chunk size."));
+  }
+  // Links of every DMA descriptor, a descriptor without an entry generates all elinks
+  std::map<unsigned, std::vector<unsigned>> dma_links;
+  for (const auto& descriptor : cfg.dma_descriptors) {
+    dma_links[descriptor.dma_id] = descriptor.links;
+  }
+  for (unsigned dma_id = 0; dma_id < m_max_dma_descriptors; ++dma_id) {
+    auto& dma = m_dmas[dma_id];
+    // One generator stream per distinct elink, repeated elinks get a larger share of the blocks
+    std::map<uint32_t, size_t> stream_of_elink; // NOLINT(build/unsigned)
+    for (auto elink : cfg.sw_elinks) {
+      if (dma_links.count(dma_id) != 0) {
+        const auto& links = dma_links[dma_id];
+        if (std::find(links.begin(), links.end(), elink / m_elink_multiplier) == links.end()) {
+          continue;
+        }
+      }
+      if (stream_of_elink.count(elink) == 0) {
+        stream_of_elink[elink] = dma.streams.size();
+        ElinkStream stream;
+        stream.elink = elink;
+        dma.streams.push_back(stream);
+      }
+      dma.stream_mix.push_back(stream_of_elink[elink]);
+    }
+  }
+}
+
+SoftwareCardBackend::~SoftwareCardBackend()
+{
+  dma_reset();
+  for (auto& dma : m_dmas) {
+    if (dma.irq_fd.load() >= 0) {
+      close(dma.irq_fd.load());
+    }
+  }
+}
+
+void
+SoftwareCardBackend::dma_reset()
+{
+  for (auto& dma : m_dmas) {
+    stop_producer(dma);
+  }
+}
+
+void
+SoftwareCardBackend::irq_enable(unsigned /*irq*/)
+{
+  m_irq_enabled.store(true);
+}
+
+void
+SoftwareCardBackend::irq_disable()
+{
+  m_irq_enabled.store(false);
+  std::lock_guard<std::mutex> lock(m_irq_mutex);
+  m_irq_cv.notify_all();
+}
+
+void
+SoftwareCardBackend::irq_wait(unsigned irq)
+{
+  // Returns when blocks were published since the last interrupt, when cancelled, or after
+  // the timeout if there is one
+  unsigned dma_id = irq - IRQ_DATA_AVAILABLE;
+  bool* cancelled = (dma_id < m_max_dma_descriptors) ? &m_dmas[dma_id].irq_cancelled : nullptr;
+  auto interrupted = [&] {
+    return m_blocks_published.load(std::memory_order_acquire) != m_irq_seen || !m_irq_enabled.load() ||
+           (cancelled != nullptr && *cancelled);
+  };
+  std::unique_lock<std::mutex> lock(m_irq_mutex);
+  ++m_irq_waiters;
+  if (m_irq_wait_timeout.count() > 0) {
+    m_irq_cv.wait_for(lock, m_irq_wait_timeout, interrupted);
+  } else {
+    m_irq_cv.wait(lock, interrupted);
+  }
+  m_irq_seen = m_blocks_published.load(std::memory_order_acquire);
+  if (cancelled != nullptr) {
+    *cancelled = false;
+  }
+  --m_irq_waiters;
+}
+
+void
+SoftwareCardBackend::irq_cancel(unsigned irq)
+{
+  unsigned dma_id = irq - IRQ_DATA_AVAILABLE;
+  if (dma_id < m_max_dma_descriptors) {
+    std::lock_guard<std::mutex> lock(m_irq_mutex);
+    m_dmas[dma_id].irq_cancelled = true;
+    m_irq_cv.notify_all();
+  }
+}
+
+int
+SoftwareCardBackend::interrupt_fd(unsigned irq)
+{
+  // Data available interrupts are numbered from IRQ_DATA_AVAILABLE by DMA descriptor,
+  // anything below wraps around to an invalid dma_id
+  unsigned dma_id = irq - IRQ_DATA_AVAILABLE;
+  if (dma_id >= m_max_dma_descriptors) {
+    return -1;
+  }
+  auto& dma = m_dmas[dma_id];
+  if (dma.irq_fd.load() < 0) {
+    dma.irq_fd.store(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+  }
+  dma.irq_armed.store(true);
+  return dma.irq_fd.load();
+}
+
+void
+SoftwareCardBackend::irq_ack(unsigned irq)
+{
+  unsigned dma_id = irq - IRQ_DATA_AVAILABLE;
+  if (dma_id < m_max_dma_descriptors) {
+    m_dmas[dma_id].irq_armed.store(true);
+  }
+}
+
+void
+SoftwareCardBackend::dma_to_host(unsigned dma_id, u_long paddr, u_long size, unsigned /*flags*/) // NOLINT
+{
+  if (dma_id >= m_max_dma_descriptors || size < 2 * m_block_size || m_dmas[dma_id].stream_mix.empty()) {
+    ers::error(CardError(ERS_HERE, "Software card backend can't start DMA " + std::to_string(dma_id)));
+    return;
+  }
+  auto& dma = m_dmas[dma_id];
+  stop_producer(dma);
+  dma.start_address = paddr;
+  dma.size = size - (size % m_block_size);
+  dma.current_address.store(paddr);
+  dma.destination.store(paddr);
+  dma.running.store(true);
+  dma.producer = std::thread(&SoftwareCardBackend::produce, this, dma_id);
+  TLOG_DEBUG(TLVL_WORK_STEPS) << "Software DMA " << dma_id << " started with " << dma.size << " Bytes.";
+}
+
+void
+SoftwareCardBackend::dma_stop(unsigned dma_id)
+{
+  if (dma_id < m_max_dma_descriptors) {
+    stop_producer(m_dmas[dma_id]);
+  }
+}
+
+void
+SoftwareCardBackend::dma_set_ptr(unsigned dma_id, u_long paddr) // NOLINT
+{
+  m_dmas[dma_id].destination.store(paddr, std::memory_order_release);
+}
+
+uint64_t // NOLINT(build/unsigned)
+SoftwareCardBackend::current_address(unsigned dma_id)
+{
+  return m_dmas[dma_id].current_address.load(std::memory_order_acquire);
+}
+
+void
+SoftwareCardBackend::stop_producer(DmaDescriptor& dma)
+{
+  dma.running.store(false);
+  if (dma.producer.joinable()) {
+    dma.producer.join();
+  }
+}
+
+void
+SoftwareCardBackend::produce(unsigned dma_id)
+{
+  auto& dma = m_dmas[dma_id];
+  const uint64_t num_blocks = dma.size / m_block_size; // NOLINT(build/unsigned)
+  uint64_t write_index = 0;                             // NOLINT(build/unsigned)
+  uint64_t produced = 0;                                // NOLINT(build/unsigned)
+  size_t mix_index = 0;
+  auto t0 = std::chrono::steady_clock::now();
+
+  while (dma.running.load(std::memory_order_relaxed)) {
+    // Never overtake the software read pointer: like the card, stall when the ring is full
+    uint64_t dest_index = (dma.destination.load(std::memory_order_acquire) - dma.start_address) / m_block_size; // NOLINT
+    bool ring_full = (dest_index + num_blocks - write_index - 1) % num_blocks == 0;
+    if (ring_full && m_block_rate == 0) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    auto& stream = dma.streams[dma.stream_mix[mix_index]];
+    mix_index = (mix_index + 1) % dma.stream_mix.size();
+    if (ring_full) {
+      // The front-end doesn't wait: the block is lost, its sequence number is skipped
+      stream.seqnum = (stream.seqnum + 1) % blockformat::seqnum_modulo;
+      m_busy_latched.store(true, std::memory_order_relaxed);
+    } else {
+      write_block(reinterpret_cast<char*>(dma.start_address + write_index * m_block_size), stream); // NOLINT
+      write_index = (write_index + 1) % num_blocks;
+      dma.current_address.store(dma.start_address + write_index * m_block_size, std::memory_order_release);
+      m_blocks_published.fetch_add(1, std::memory_order_release);
+      if (dma.irq_armed.load(std::memory_order_relaxed) && m_irq_enabled.load(std::memory_order_relaxed) &&
+          dma.irq_armed.exchange(false)) {
+        uint64_t one = 1; // NOLINT(build/unsigned)
+        [[maybe_unused]] auto ret = write(dma.irq_fd.load(), &one, sizeof(one));
+      }
+      if (m_irq_waiters.load(std::memory_order_relaxed) > 0) {
+        std::lock_guard<std::mutex> lock(m_irq_mutex);
+        m_irq_cv.notify_all();
+      }
+    }
+
+    // Rate limiting. Long sleeps at low rates are cut into slices, so that stop doesn't wait for them.
+    ++produced;
+    if (m_block_rate != 0) {
+      auto target = t0 + std::chrono::nanoseconds(produced * 1000000000UL / m_block_rate);
+      auto now = std::chrono::steady_clock::now();
+      if (target - now > std::chrono::microseconds(50)) {
+        while (now < target && dma.running.load(std::memory_order_relaxed)) {
+          std::this_thread::sleep_until(std::min(target, now + m_stop_check_interval));
+          now = std::chrono::steady_clock::now();
+        }
+      } else if (target > now) {
+        std::this_thread::yield();
+      }
+    }
+  }
+}
+
+void
+SoftwareCardBackend::write_block(char* block_addr, ElinkStream& stream)
+{
+  using namespace blockformat;
+  auto* block = reinterpret_cast<felix::packetformat::block*>(block_addr); // NOLINT
+  block->elink = stream.elink;
+  block->seqnum = stream.seqnum;
+  block->sob = (m_trailer_size == 4) ? sob_32b_trailer : sob_16b_trailer;
+  stream.seqnum = (stream.seqnum + 1) % seqnum_modulo;
+
+  size_t pos = header_size;
+  while (m_block_size - pos > m_trailer_size) {
+    bool first = false;
+    if (stream.chunk_remaining == 0) {
+      stream.chunk_remaining = m_chunk_size;
+      ++stream.chunk_pattern;
+      first = true;
+    }
+    // Longer chunks than the trailer's length field holds continue in the next subchunk
+    size_t length = std::min({ stream.chunk_remaining, m_block_size - pos - m_trailer_size, m_max_subchunk_length });
+    bool last = (length == stream.chunk_remaining);
+
+    SubchunkTrailer trailer;
+    trailer.length = length;
+    trailer.type = first ? (last ? SubchunkType::kBoth : SubchunkType::kFirst)
+                         : (last ? SubchunkType::kLast : SubchunkType::kMiddle);
+    std::memset(block_addr + pos, stream.chunk_pattern, length);
+    pos += padded_length(length, m_trailer_size);
+    write_trailer(block_addr + pos, trailer);
+    pos += m_trailer_size;
+    stream.chunk_remaining -= length;
+  }
+
+  // The loop leaves room for one trailer at most: an empty null subchunk
+  if (pos < m_block_size) {
+    write_trailer(block_addr + pos, SubchunkTrailer());
+  }
+}
+
+void
+SoftwareCardBackend::write_trailer(char* trailer_addr, const blockformat::SubchunkTrailer& trailer)
+{
+  if (m_trailer_size == 4) {
+    uint32_t word = blockformat::encode_trailer_32b(trailer); // NOLINT(build/unsigned)
+    std::memcpy(trailer_addr, &word, sizeof(word));
+  } else {
+    uint16_t word = blockformat::encode_trailer_16b(trailer); // NOLINT(build/unsigned)
+    std::memcpy(trailer_addr, &word, sizeof(word));
+  }
+}
+
+} // namespace flxlibs
+} // namespace dunedaq
@@ -0,0 +1,122 @@
+/**
+ * @file SoftwareCardBackend.hpp Software emulation of a FELIX card's to-host DMA
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef FLXLIBS_SRC_SOFTWARECARDBACKEND_HPP_
+#define FLXLIBS_SRC_SOFTWARECARDBACKEND_HPP_
+
+#include "CardBackend.hpp"
+#include "FelixBlockFormat.hpp"
+
+#include "flxlibs/felixcardreader/Structs.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dunedaq::flxlibs {
+
+/**
+ * @brief Emulates the to-host DMA of a FELIX card. A producer thread per started
+ * DMA descriptor fills the circular buffer with FELIX formatted blocks at the
+ * configured rate and elink mix, restricted to the links of the descriptor if
+ * dma_descriptors are configured. It moves the current address forward, and never
+ * overtakes the pointer set via dma_set_ptr. At a fixed rate, blocks that find the
+ * ring full are dropped and the to-host busy latch is set, like on the card; without
+ * a rate the producer stalls instead. The card "physical" addresses are
+ * virtual addresses, so DMA buffers come from an allocator with virtual DMA addresses.
+ */
+class SoftwareCardBackend : public CardBackend
+{
+public:
+  explicit SoftwareCardBackend(const felixcardreader::Conf& cfg);
+  ~SoftwareCardBackend();
+
+  void card_open(int /*absolute_card_id*/) override {}
+  void card_close() override {}
+  bool virtual_dma_addresses() const override { return true; }
+
+  void dma_reset() override;
+  void soft_reset() override {}
+  void irq_reset_counters() override {}
+  void irq_enable(unsigned irq) override;
+  void irq_disable() override;
+  void irq_wait(unsigned irq) override;
+  void irq_cancel(unsigned irq) override;
+  int interrupt_fd(unsigned irq) override;
+  void irq_ack(unsigned irq) override;
+
+  void dma_to_host(unsigned dma_id, u_long paddr, u_long size, unsigned flags) override; // NOLINT
+  void dma_stop(unsigned dma_id) override;
+  void dma_set_ptr(unsigned dma_id, u_long paddr) override; // NOLINT
+  uint64_t current_address(unsigned dma_id) override;       // NOLINT
+  bool tohost_busy_latched() override { return m_busy_latched.exchange(false); }
+
+private:
+  // Constants
+  static constexpr unsigned m_max_dma_descriptors = 8;
+  static constexpr unsigned m_elink_multiplier = 64;
+  static constexpr auto m_stop_check_interval = std::chrono::milliseconds(10);
+
+  // Per elink generator state. Chunks continue across blocks of the same elink.
+  struct ElinkStream
+  {
+    uint32_t elink{ 0 };     // NOLINT(build/unsigned)
+    uint32_t seqnum{ 0 };    // NOLINT(build/unsigned)
+    size_t chunk_remaining{ 0 };
+    uint8_t chunk_pattern{ 0 }; // NOLINT(build/unsigned)
+  };
+
+  struct DmaDescriptor
+  {
+    std::atomic<bool> running{ false };
+    std::atomic<uint64_t> current_address{ 0 }; // NOLINT(build/unsigned)
+    std::atomic<uint64_t> destination{ 0 };     // NOLINT(build/unsigned)
+    uint64_t start_address{ 0 };                // NOLINT(build/unsigned)
+    uint64_t size{ 0 };                         // NOLINT(build/unsigned)
+    std::vector<ElinkStream> streams;
+    std::vector<size_t> stream_mix;
+    std::thread producer;
+    // Data available interrupt as eventfd, written once per irq_ack
+    std::atomic<int> irq_fd{ -1 };
+    std::atomic<bool> irq_armed{ false };
+    bool irq_cancelled{ false }; // under m_irq_mutex
+  };
+
+  void produce(unsigned dma_id);
+  void write_block(char* block, ElinkStream& stream);
+  void write_trailer(char* trailer_addr, const blockformat::SubchunkTrailer& trailer);
+  void stop_producer(DmaDescriptor& dma);
+
+  // Generator configuration
+  size_t m_block_size;
+  size_t m_trailer_size;
+  size_t m_max_subchunk_length; // of the trailer's length field
+  size_t m_chunk_size;
+  uint64_t m_block_rate; // NOLINT(build/unsigned)
+  std::chrono::milliseconds m_irq_wait_timeout; // 0 waits for the interrupt like the card
+
+  // DMA
+  std::array<DmaDescriptor, m_max_dma_descriptors> m_dmas;
+
+  std::atomic<bool> m_busy_latched{ false };
+
+  // Interrupt emulation: data-available fires for every published block
+  std::atomic<bool> m_irq_enabled{ false };
+  std::atomic<uint64_t> m_blocks_published{ 0 }; // NOLINT(build/unsigned)
+  std::atomic<int> m_irq_waiters{ 0 };
+  uint64_t m_irq_seen{ 0 }; // NOLINT(build/unsigned)
+  std::mutex m_irq_mutex;
+  std::condition_variable m_irq_cv;
+};
+
+} // namespace dunedaq::flxlibs
+
+#endif // FLXLIBS_SRC_SOFTWARECARDBACKEND_HPP_
@@ -0,0 +1,94 @@
+/**
+ * @file ThreadAffinity.cpp CPU affinity of the readout threads
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+// From Module
+#include "ThreadAffinity.hpp"
+
+// From STD
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+namespace dunedaq {
+namespace flxlibs {
+
+std::vector<int>
+parse_cpu_list(const std::string& cpu_list)
+{
+  std::vector<int> cpus;
+  std::istringstream ranges(cpu_list);
+  std::string range;
+  while (std::getline(ranges, range, ',')) {
+    if (range.empty() || range == "\n") {
+      continue;
+    }
+    auto dash = range.find('-');
+    try {
+      int first = std::stoi(range.substr(0, dash));
+      int last = (dash == std::string::npos) ? first : std::stoi(range.substr(dash + 1));
+      for (int cpu = first; cpu <= last; ++cpu) {
+        cpus.push_back(cpu);
+      }
+    } catch (const std::exception&) {
+      return {};
+    }
+  }
+  return cpus;
+}
+
+std::vector<int>
+numa_node_cpus(int numa_node)
+{
+  std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(numa_node) + "/cpulist");
+  std::string line;
+  if (!std::getline(cpulist, line)) {
+    return {};
+  }
+  return parse_cpu_list(line);
+}
+
+std::vector<int>
+thread_cpus(const std::vector<unsigned>& configured_cpus, int numa_node, size_t thread_index)
+{
+  if (!configured_cpus.empty()) {
+    return { static_cast<int>(configured_cpus[thread_index % configured_cpus.size()]) };
+  }
+  return numa_node_cpus(numa_node);
+}
+
+bool
+set_current_thread_affinity(const std::vector<int>& cpus)
+{
+  if (cpus.empty()) {
+    return true;
+  }
+  cpu_set_t cpuset;
+  CPU_ZERO(&cpuset);
+  for (auto cpu : cpus) {
+    if (cpu >= 0 && cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &cpuset);
+    }
+  }
+  return pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) == 0;
+}
+
+std::string
+cpus_to_string(const std::vector<int>& cpus)
+{
+  std::ostringstream oss;
+  for (size_t i = 0; i < cpus.size(); ++i) {
+    oss << (i ? "," : "") << cpus[i];
+  }
+  return oss.str();
+}
+
+} // namespace flxlibs
+} // namespace dunedaq
@@ -0,0 +1,35 @@
+/**
+ * @file ThreadAffinity.hpp CPU affinity of the readout threads
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef FLXLIBS_SRC_THREADAFFINITY_HPP_
+#define FLXLIBS_SRC_THREADAFFINITY_HPP_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace dunedaq::flxlibs {
+
+// Parses a kernel CPU list like "0-7,16-23"
+std::vector<int> parse_cpu_list(const std::string& cpu_list);
+
+// CPUs of a NUMA node from /sys/devices/system/node/nodeN/cpulist, empty if unknown
+std::vector<int> numa_node_cpus(int numa_node);
+
+// CPU set of the thread_index-th thread of a kind: the configured CPU of that index
+// (round robin) if CPUs are configured, otherwise all CPUs of the NUMA node.
+std::vector<int> thread_cpus(const std::vector<unsigned>& configured_cpus, int numa_node, size_t thread_index);
+
+// Pins the calling thread. An empty set leaves the affinity untouched. Returns false on failure.
+bool set_current_thread_affinity(const std::vector<int>& cpus);
+
+// Text form of a CPU set for logs
+std::string cpus_to_string(const std::vector<int>& cpus);
+
+} // namespace dunedaq::flxlibs
+
+#endif // FLXLIBS_SRC_THREADAFFINITY_HPP_
@@ -0,0 +1,88 @@
+/**
+ * @file WorkCompletion.hpp Event based wait for the work of a ReusableThread
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef FLXLIBS_SRC_WORKCOMPLETION_HPP_
+#define FLXLIBS_SRC_WORKCOMPLETION_HPP_
+
+#include "readoutlibs/utils/ReusableThread.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace dunedaq::flxlibs {
+
+/**
+ * @brief ReusableThread only offers get_readiness() to poll for the end of its work.
+ * The work function holds a guard that signals its return, so that the stopping thread
+ * waits on a condition variable instead of sleeping in a loop. Readiness follows the
+ * return within a few instructions, the remaining wait only yields.
+ */
+class WorkCompletion
+{
+public:
+  class Guard
+  {
+  public:
+    explicit Guard(WorkCompletion& completion)
+      : m_completion(completion)
+    {}
+    ~Guard() { m_completion.done(); }
+    Guard(const Guard&) = delete;            ///< Guard is not copy-constructible
+    Guard& operator=(const Guard&) = delete; ///< Guard is not copy-assignable
+    Guard(Guard&&) = delete;                 ///< Guard is not move-constructible
+    Guard& operator=(Guard&&) = delete;      ///< Guard is not move-assignable
+
+  private:
+    WorkCompletion& m_completion;
+  };
+
+  // Assigns the work to the thread. Returns false if the thread is still busy.
+  template<typename Function, typename... Args>
+  bool set_work(readoutlibs::ReusableThread& thread, Function&& f, Args&&... args)
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_done = false;
+    }
+    if (!thread.set_work(std::forward<Function>(f), std::forward<Args>(args)...)) {
+      done();
+      return false;
+    }
+    return true;
+  }
+
+  void done()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_done = true;
+    }
+    m_cv.notify_all();
+  }
+
+  // Returns once the work returned and the thread takes new work
+  void wait(const readoutlibs::ReusableThread& thread)
+  {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cv.wait(lock, [this] { return m_done; });
+    }
+    while (!thread.get_readiness()) {
+      std::this_thread::yield();
+    }
+  }
+
+private:
+  std::mutex m_mutex;
+  std::condition_variable m_cv;
+  bool m_done{ true };
+};
+
+} // namespace dunedaq::flxlibs
+
+#endif // FLXLIBS_SRC_WORKCOMPLETION_HPP_
@@ -0,0 +1,437 @@
+/**
+ * @file test_block_decoder_app.cxx Checks that the native 32b trailer block decoder,
+ * scalar and AVX2, emits the same events as packetformat's BlockParser on synthetic and
+ * optionally captured blocks, both to plain parser operations and through the
+ * PolicyParserImpl of the elinks, and reports the decode throughput of each on one core.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#include "BlockDecoder32b.hpp"
+#include "FelixBlockFormat.hpp"
+#include "FelixStatistics.hpp"
+#include "PolicyParserImpl.hpp"
+
+#include "logging/Logging.hpp"
+
+#include "packetformat/block_format.hpp"
+#include "packetformat/block_parser.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace dunedaq::flxlibs;
+
+namespace {
+
+constexpr size_t block_size = 4096;
+
+// Streams of one elink, with the mix of chunks of a kind of link
+struct Profile
+{
+  std::string name;
+  size_t min_chunk;
+  size_t max_chunk;
+  double error_rate;   // subchunks with an error flag
+  double timeout_rate; // timeout subchunks between chunks
+  double null_rate;    // blocks closed early with a null subchunk
+  double corrupt_rate; // blocks with a bad header or trailer chain
+  // Chunk sizes in turn instead of min_chunk to max_chunk: runs of equal subchunks with
+  // odd ones in between, which the speculative AVX2 walk mispredicts
+  std::vector<size_t> size_cycle = {};
+  double scramble_rate = 0.; // blocks with a random word overwritten, in a trailer or not
+};
+
+std::vector<char>
+make_corpus(const Profile& profile, size_t num_blocks, unsigned seed)
+{
+  using namespace blockformat;
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<double> uniform(0., 1.);
+  std::uniform_int_distribution<size_t> chunk_size(profile.min_chunk, profile.max_chunk);
+  std::vector<char> corpus(num_blocks * block_size);
+  size_t chunk_remaining = 0;
+  size_t cycle_index = 0;
+  auto next_chunk_size = [&]() {
+    return profile.size_cycle.empty() ? chunk_size(rng) : profile.size_cycle[cycle_index++ % profile.size_cycle.size()];
+  };
+  auto write_trailer = [](char* at, const SubchunkTrailer& trailer) {
+    uint32_t word = encode_trailer_32b(trailer); // NOLINT(build/unsigned)
+    std::memcpy(at, &word, sizeof(word));
+  };
+
+  for (size_t b = 0; b < num_blocks; ++b) {
+    char* block_addr = corpus.data() + b * block_size;
+    auto* block = reinterpret_cast<felix::packetformat::block*>(block_addr); // NOLINT
+    block->elink = 0;
+    block->seqnum = b % seqnum_modulo;
+    block->sob = sob_32b_trailer;
+
+    size_t pos = header_size;
+    while (block_size - pos > BlockDecoder32b::s_trailer_size) {
+      size_t avail = block_size - pos - BlockDecoder32b::s_trailer_size;
+      SubchunkTrailer trailer;
+      if (uniform(rng) < profile.null_rate / 16) {
+        trailer.length = avail; // pads the rest of the block
+      } else if (chunk_remaining == 0 && uniform(rng) < profile.timeout_rate) {
+        trailer.type = SubchunkType::kTimeout;
+        trailer.length = std::min<size_t>(avail, 8);
+      } else {
+        bool first = false;
+        if (chunk_remaining == 0) {
+          chunk_remaining = next_chunk_size();
+          first = true;
+        }
+        trailer.length = std::min(chunk_remaining, avail);
+        bool last = (trailer.length == chunk_remaining);
+        trailer.type = first ? (last ? SubchunkType::kBoth : SubchunkType::kFirst)
+                             : (last ? SubchunkType::kLast : SubchunkType::kMiddle);
+        chunk_remaining -= trailer.length;
+        if (uniform(rng) < profile.error_rate) {
+          trailer.err = uniform(rng) < 0.5;
+          trailer.trunc = !trailer.err;
+          trailer.crcerr = uniform(rng) < 0.5;
+        }
+      }
+      for (size_t i = 0; i < trailer.length; ++i) {
+        block_addr[pos + i] = static_cast<char>(rng());
+      }
+      pos += padded_length(trailer.length, BlockDecoder32b::s_trailer_size);
+      write_trailer(block_addr + pos, trailer);
+      pos += BlockDecoder32b::s_trailer_size;
+    }
+    if (pos < block_size) {
+      write_trailer(block_addr + pos, SubchunkTrailer());
+    }
+
+    if (uniform(rng) < profile.corrupt_rate) {
+      if (uniform(rng) < 0.5) {
+        block->sob = sob_16b_trailer;
+      } else {
+        SubchunkTrailer broken;
+        broken.type = SubchunkType::kLast;
+        broken.length = 0xFFFF;
+        write_trailer(block_addr + block_size - BlockDecoder32b::s_trailer_size, broken);
+      }
+    }
+    if (uniform(rng) < profile.scramble_rate) {
+      size_t word = header_size / 4 + rng() % ((block_size - header_size) / 4);
+      uint32_t value = rng(); // NOLINT(build/unsigned)
+      std::memcpy(block_addr + word * 4, &value, sizeof(value));
+    }
+  }
+  return corpus;
+}
+
+uint64_t // NOLINT(build/unsigned)
+fnv1a(uint64_t hash, const char* data, size_t length) // NOLINT(build/unsigned)
+{
+  for (size_t i = 0; i < length; ++i) {
+    hash = (hash ^ static_cast<unsigned char>(data[i])) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+// Records every event with its length and a hash of its data
+class Recorder : public felix::packetformat::ParserOperations
+{
+public:
+  enum Event : uint64_t // NOLINT(build/unsigned)
+  {
+    kChunk = 1,
+    kShortchunk,
+    kSubchunk,
+    kBlock,
+    kChunkError,
+    kSubchunkError,
+    kShortchunkError,
+    kBlockError
+  };
+
+  template<class Chunk>
+  void chunk_processed(const Chunk& chunk)
+  {
+    record_chunk(kChunk, chunk);
+  }
+  template<class Chunk>
+  void chunk_processed_with_error(const Chunk& chunk)
+  {
+    record_chunk(kChunkError, chunk);
+  }
+  void shortchunk_processed(const felix::packetformat::shortchunk& shortchunk)
+  {
+    record(kShortchunk, shortchunk.length, fnv1a(0, shortchunk.data, shortchunk.length));
+  }
+  void shortchunk_process_with_error(const felix::packetformat::shortchunk& shortchunk)
+  {
+    record(kShortchunkError, shortchunk.length, fnv1a(0, shortchunk.data, shortchunk.length));
+  }
+  void subchunk_processed(const felix::packetformat::subchunk& subchunk)
+  {
+    record(kSubchunk, subchunk.length, reinterpret_cast<uint64_t>(subchunk.data)); // NOLINT
+  }
+  void subchunk_processed_with_error(const felix::packetformat::subchunk& subchunk)
+  {
+    uint64_t flags = subchunk.err_flag | (subchunk.trunc_flag << 1) | (subchunk.crcerr_flag << 2); // NOLINT
+    record(kSubchunkError, subchunk.length, reinterpret_cast<uint64_t>(subchunk.data) ^ flags); // NOLINT
+  }
+  void block_processed(const felix::packetformat::block& block)
+  {
+    record(kBlock, 0, reinterpret_cast<uint64_t>(&block)); // NOLINT
+  }
+  void block_processed_with_error(const felix::packetformat::block& block)
+  {
+    record(kBlockError, 0, reinterpret_cast<uint64_t>(&block)); // NOLINT
+  }
+
+  std::vector<uint64_t> events; // NOLINT(build/unsigned)
+  std::vector<size_t> counts = std::vector<size_t>(kBlockError + 1, 0);
+
+private:
+  template<class Chunk>
+  void record_chunk(Event event, const Chunk& chunk)
+  {
+    uint64_t hash = 0; // NOLINT(build/unsigned)
+    for (unsigned i = 0; i < chunk.subchunk_number(); ++i) {
+      hash = fnv1a(hash, chunk.subchunks()[i], chunk.subchunk_lengths()[i]);
+    }
+    record(event, chunk.length(), hash);
+  }
+  void record(Event event, uint64_t length, uint64_t hash) // NOLINT(build/unsigned)
+  {
+    events.push_back(event);
+    events.push_back(length);
+    events.push_back(hash);
+    counts[event]++;
+  }
+};
+
+// Handler of every policy of a PolicyParserImpl: records the chunks, shortchunks and
+// blocks that the parser hands to its policies
+template<uint64_t Event> // NOLINT(build/unsigned)
+struct RecordInto
+{
+  std::vector<uint64_t>* events{ nullptr }; // NOLINT(build/unsigned)
+
+  template<class Chunk>
+  void operator()(const Chunk& chunk) const
+  {
+    uint64_t hash = 0; // NOLINT(build/unsigned)
+    for (unsigned i = 0; i < chunk.subchunk_number(); ++i) {
+      hash = fnv1a(hash, chunk.subchunks()[i], chunk.subchunk_lengths()[i]);
+    }
+    record(chunk.length(), hash);
+  }
+  void operator()(const felix::packetformat::shortchunk& shortchunk) const
+  {
+    record(shortchunk.length, fnv1a(0, shortchunk.data, shortchunk.length));
+  }
+  void operator()(const felix::packetformat::block& block) const
+  {
+    record(0, reinterpret_cast<uint64_t>(&block)); // NOLINT
+  }
+
+private:
+  void record(uint64_t length, uint64_t hash) const // NOLINT(build/unsigned)
+  {
+    events->push_back(Event);
+    events->push_back(length);
+    events->push_back(hash);
+  }
+};
+
+using RecordingParserImpl = PolicyParserImpl<RecordInto<Recorder::kChunk>,
+                                             RecordInto<Recorder::kShortchunk>,
+                                             RecordInto<Recorder::kBlock>,
+                                             RecordInto<Recorder::kChunkError>>;
+
+// Events handed to the policies and the parser statistics of one run
+struct PolicyRun
+{
+  std::vector<uint64_t> events; // NOLINT(build/unsigned)
+  stats::ParserSnapshot stats;
+
+  bool operator==(const PolicyRun& other) const
+  {
+    const auto& a = stats;
+    const auto& b = other.stats;
+    return events == other.events && a.packet_ctr == b.packet_ctr && a.short_ctr == b.short_ctr &&
+           a.chunk_ctr == b.chunk_ctr && a.subchunk_ctr == b.subchunk_ctr && a.block_ctr == b.block_ctr &&
+           a.error_short_ctr == b.error_short_ctr && a.error_chunk_ctr == b.error_chunk_ctr &&
+           a.error_subchunk_ctr == b.error_subchunk_ctr && a.error_block_ctr == b.error_block_ctr &&
+           a.subchunk_crc_error_ctr == b.subchunk_crc_error_ctr &&
+           a.subchunk_trunc_error_ctr == b.subchunk_trunc_error_ctr && a.subchunk_error_ctr == b.subchunk_error_ctr;
+  }
+};
+
+// Counts events and bytes only, as the parser statistics do, to time the decoding itself
+class Counter : public felix::packetformat::ParserOperations
+{
+public:
+  template<class Chunk>
+  void chunk_processed(const Chunk& chunk)
+  {
+    bytes += chunk.length();
+  }
+  template<class Chunk>
+  void chunk_processed_with_error(const Chunk& /*chunk*/)
+  {
+    ++errors;
+  }
+  void shortchunk_processed(const felix::packetformat::shortchunk& shortchunk) { bytes += shortchunk.length; }
+  void shortchunk_process_with_error(const felix::packetformat::shortchunk& /*shortchunk*/) { ++errors; }
+  void subchunk_processed(const felix::packetformat::subchunk& /*subchunk*/) { ++subchunks; }
+  void subchunk_processed_with_error(const felix::packetformat::subchunk& /*subchunk*/) { ++errors; }
+  void block_processed(const felix::packetformat::block& /*block*/) { ++blocks; }
+  void block_processed_with_error(const felix::packetformat::block& /*block*/) { ++errors; }
+
+  size_t bytes{ 0 };
+  size_t subchunks{ 0 };
+  size_t blocks{ 0 };
+  size_t errors{ 0 };
+};
+
+const felix::packetformat::block*
+block_at(const std::vector<char>& corpus, size_t b)
+{
+  return felix::packetformat::block_from_bytes(corpus.data() + b * block_size);
+}
+
+template<class Ops>
+void
+run_block_parser(const std::vector<char>& corpus, Ops& ops)
+{
+  felix::packetformat::BlockParser<Ops> parser(ops);
+  parser.configure(block_size, true);
+  for (size_t b = 0; b < corpus.size() / block_size; ++b) {
+    parser.process(block_at(corpus, b));
+  }
+}
+
+template<class Ops>
+void
+run_decoder(const std::vector<char>& corpus, Ops& ops, bool use_simd)
+{
+  BlockDecoder32b decoder(use_simd);
+  decoder.configure(block_size);
+  for (size_t b = 0; b < corpus.size() / block_size; ++b) {
+    decoder.decode(block_at(corpus, b), ops);
+  }
+}
+
+// The elink pipeline: BlockParser or the native decoder over a PolicyParserImpl
+template<class Decode>
+PolicyRun
+run_policy(const std::vector<char>& corpus, Decode&& decode)
+{
+  PolicyRun run;
+  RecordingParserImpl impl;
+  impl.chunk_policy().events = &run.events;
+  impl.shortchunk_policy().events = &run.events;
+  impl.block_policy().events = &run.events;
+  impl.error_chunk_policy().events = &run.events;
+  decode(impl);
+  run.stats = impl.get_stats().snapshot();
+  return run;
+}
+
+// Events of BlockParser and of the scalar and AVX2 decoders, to plain parser operations
+// and through the PolicyParserImpl of the elinks
+bool
+conforms(const std::string& name, const std::vector<char>& corpus)
+{
+  Recorder reference;
+  run_block_parser(corpus, reference);
+  Recorder scalar;
+  run_decoder(corpus, scalar, false);
+  Recorder vector;
+  run_decoder(corpus, vector, true);
+  bool same_events = (scalar.events == reference.events && vector.events == reference.events);
+
+  auto policy_reference = run_policy(corpus, [&](RecordingParserImpl& impl) { run_block_parser(corpus, impl); });
+  auto policy_scalar = run_policy(corpus, [&](RecordingParserImpl& impl) { run_decoder(corpus, impl, false); });
+  auto policy_vector = run_policy(corpus, [&](RecordingParserImpl& impl) { run_decoder(corpus, impl, true); });
+  bool same_policy = (policy_scalar == policy_reference && policy_vector == policy_reference);
+
+  const auto& counts = reference.counts;
+  TLOG() << name << ": " << counts[Recorder::kChunk] << " chunks, " << counts[Recorder::kShortchunk] << " shortchunks, "
+         << counts[Recorder::kSubchunk] << " subchunks, "
+         << counts[Recorder::kChunkError] + counts[Recorder::kShortchunkError] + counts[Recorder::kSubchunkError] +
+              counts[Recorder::kBlockError]
+         << " errors (" << counts[Recorder::kBlockError] << " blocks). Events "
+         << (same_events ? "identical" : "DIFFER") << ", policy events and statistics "
+         << (same_policy ? "identical" : "DIFFER");
+  return same_events && same_policy;
+}
+
+template<class Run>
+double
+gbytes_per_second(const std::vector<char>& corpus, size_t passes, Run&& run)
+{
+  auto t0 = std::chrono::steady_clock::now();
+  for (size_t pass = 0; pass < passes; ++pass) {
+    run();
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  return static_cast<double>(corpus.size() * passes) / seconds / 1e9;
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+  // Usage: flxlibs_test_block_decoder [blocks per profile] [file of captured 4 kB blocks]
+  const size_t num_blocks = (argc > 1) ? std::stoul(argv[1]) : 4096;
+  const size_t passes = 10;
+  const std::vector<Profile> profiles = {
+    { "64 B frames", 64, 64, 0., 0., 0., 0. },
+    { "WIB superchunks", 5568, 5568, 0., 0., 0., 0. },
+    { "variable 1-600 B with errors", 1, 600, 0.01, 0.01, 0.05, 0.002 },
+    { "variable 16-4000 B", 16, 4000, 0., 0.02, 0.1, 0. },
+    { "mixed lengths", 0, 0, 0., 0., 0., 0., { 60, 60, 60, 60, 60, 60, 60, 124, 12, 12, 12, 12, 12, 12, 12, 12, 12, 200 } },
+    { "empty and tiny chunks", 0, 8, 0.05, 0.05, 0.05, 0. },
+    { "malformed trailers", 1, 600, 0.01, 0.01, 0.05, 0.2, {}, 0.3 },
+  };
+  bool simd = BlockDecoder32b(true).uses_simd();
+  TLOG() << "Block size " << block_size << " B, " << num_blocks << " blocks per profile, AVX2 "
+         << (simd ? "available" : "not available, the SIMD runs are scalar");
+
+  int ret = 0;
+  unsigned seed = 1;
+  for (const auto& profile : profiles) {
+    auto corpus = make_corpus(profile, num_blocks, seed++);
+    if (!conforms(profile.name, corpus)) {
+      ret = 1;
+    }
+
+    Counter counter;
+    double parser_gbs = gbytes_per_second(corpus, passes, [&]() { run_block_parser(corpus, counter); });
+    double scalar_gbs = gbytes_per_second(corpus, passes, [&]() { run_decoder(corpus, counter, false); });
+    double simd_gbs = gbytes_per_second(corpus, passes, [&]() { run_decoder(corpus, counter, true); });
+
+    TLOG() << profile.name << ": decode GB/s per core: BlockParser " << parser_gbs << ", native scalar "
+           << scalar_gbs << ", native AVX2 " << simd_gbs;
+  }
+
+  if (argc > 2) {
+    std::ifstream file(argv[2], std::ios::binary);
+    std::vector<char> captured((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    captured.resize(captured.size() - captured.size() % block_size);
+    if (captured.empty()) {
+      TLOG() << "No blocks in " << argv[2];
+      ret = 1;
+    } else if (!conforms(std::string("captured ") + argv[2], captured)) {
+      ret = 1;
+    }
+  }
+  return ret;
+}
@@ -0,0 +1,90 @@
+/**
+ * @file test_block_handler_bench_app.cxx Benchmark of the CardWrapper block
+ * handler paths: one std::function call per block address versus one call
+ * per contiguous span of blocks.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#include "CardWrapper.hpp"
+
+#include "logging/Logging.hpp"
+
+#include "packetformat/block_format.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace dunedaq::flxlibs;
+
+int
+main(int argc, char* argv[])
+{
+  // Usage: flxlibs_test_block_handler_bench [blocks per DMA loop iteration]
+  const size_t blocks_per_iteration = (argc > 1) ? std::stoul(argv[1]) : 256;
+  constexpr size_t block_size = CardWrapper::get_block_size();
+  constexpr size_t num_blocks = 16384; // 64 MB ring
+  constexpr size_t num_passes = 200;
+  constexpr int num_elinks = 5;
+
+  // Ring of blocks with headers of 5 elinks, round robin
+  std::vector<char> ring(num_blocks * block_size);
+  for (size_t i = 0; i < num_blocks; ++i) {
+    auto* block = reinterpret_cast<felix::packetformat::block*>(ring.data() + i * block_size); // NOLINT
+    block->elink = (i % num_elinks) * 64;
+    block->seqnum = (i / num_elinks) % 32;
+  }
+  const uint64_t ring_start = reinterpret_cast<uint64_t>(ring.data()); // NOLINT
+
+  // Same routing work in both paths: read the header, count per elink
+  std::array<size_t, 2048> elink_counters{};
+  auto route = [&](uint64_t block_addr) { // NOLINT
+    const auto* block = felix::packetformat::block_from_bytes(reinterpret_cast<const char*>(block_addr)); // NOLINT
+    elink_counters[block->elink]++;
+  };
+  std::function<void(uint64_t)> block_handler = route; // NOLINT
+  std::function<void(uint64_t, size_t)> span_handler = [&](uint64_t first_block_addr, size_t count) { // NOLINT
+    for (size_t i = 0; i < count; ++i) {
+      route(first_block_addr + i * block_size);
+    }
+  };
+
+  // Walk the ring the way CardWrapper::process_DMA does, in iterations of blocks_per_iteration
+  auto run = [&](bool use_spans) {
+    size_t read_index = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t n = 0; n < num_passes * num_blocks / blocks_per_iteration; ++n) {
+      size_t write_index = (read_index + blocks_per_iteration) % num_blocks;
+      if (use_spans) {
+        while (read_index != write_index) {
+          size_t span_end = (write_index > read_index) ? write_index : num_blocks;
+          span_handler(ring_start + read_index * block_size, span_end - read_index);
+          read_index = span_end % num_blocks;
+        }
+      } else {
+        while (read_index != write_index) {
+          block_handler(ring_start + read_index * block_size);
+          read_index = (read_index + 1) % num_blocks;
+        }
+      }
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    double blocks = static_cast<double>(num_passes * num_blocks / blocks_per_iteration * blocks_per_iteration);
+    return std::chrono::duration<double, std::nano>(t1 - t0).count() / blocks;
+  };
+
+  run(false); // warm up
+  double per_block_ns = run(false);
+  double per_span_ns = run(true);
+
+  TLOG() << "Blocks per DMA loop iteration: " << blocks_per_iteration;
+  TLOG() << "Per block handler: " << per_block_ns << " ns/block";
+  TLOG() << "Block span handler: " << per_span_ns << " ns/block";
+  TLOG() << "Blocks routed to elink 0: " << elink_counters[0];
+  return 0;
+}
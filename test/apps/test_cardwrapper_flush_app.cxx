@@ -0,0 +1,86 @@
+/**
+ * @file test_cardwrapper_flush_app.cxx Checks that CardWrapper hands out blocks below
+ * the block threshold at their flush deadline on a quiet link, in poll, interrupt and
+ * interrupt dispatcher mode, on a software card that generates one block a second.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#include "CardWrapper.hpp"
+
+#include "logging/Logging.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+
+using namespace dunedaq::flxlibs;
+
+namespace {
+
+constexpr size_t flush_timeout_us = 20000;
+
+int failures = 0;
+
+void
+check(bool condition, const std::string& what)
+{
+  if (!condition) {
+    TLOG() << "FAILED: " << what;
+    ++failures;
+  }
+}
+
+void
+check_flush(const std::string& mode, nlohmann::json conf)
+{
+  nlohmann::json cmd_params = "{}"_json;
+  conf["card_backend"] = "software";
+  conf["chunk_trailer_size"] = 32;
+  conf["dma_memory_size_gb"] = 1;
+  conf["sw_block_rate"] = 1;
+  conf["sw_irq_wait_timeout"] = 0;
+  conf["dma_block_threshold"] = 64;
+  conf["dma_flush_timeout"] = flush_timeout_us;
+
+  CardWrapper flx;
+  std::atomic<int64_t> first_block_ns{ 0 }; // NOLINT(build/unsigned)
+  auto t0 = std::chrono::steady_clock::now();
+  std::function<void(uint64_t)> note_block_addr = [&](uint64_t /*block_addr*/) { // NOLINT
+    int64_t none = 0;
+    first_block_ns.compare_exchange_strong(
+      none, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count());
+  };
+  flx.set_block_addr_handler(note_block_addr);
+  flx.init(cmd_params);
+  flx.configure(conf);
+  t0 = std::chrono::steady_clock::now();
+  flx.start(cmd_params);
+  // The first block is generated at start, the next one a second later
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  double first_block_ms = first_block_ns.load() / 1e6;
+  check(first_block_ns.load() != 0, mode + ": block below the threshold not handed out on a quiet link");
+  check(first_block_ms < flush_timeout_us / 1000. + 200., mode + ": block handed out after " +
+                                                             std::to_string(first_block_ms) + " ms");
+  TLOG() << mode << ": first block handed out after " << first_block_ms << " ms";
+  flx.stop(cmd_params);
+  flx.scrap(cmd_params);
+}
+
+} // namespace
+
+int
+main(int /*argc*/, char** /*argv[]*/)
+{
+  check_flush("poll", { { "interrupt_mode", false } });
+  check_flush("interrupt", { { "interrupt_mode", true } });
+  check_flush("interrupt dispatcher", { { "interrupt_mode", true }, { "irq_dispatcher_threads", 1 } });
+
+  TLOG() << (failures == 0 ? "All checks passed" : std::to_string(failures) + " checks failed");
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,107 @@
+/**
+ * @file test_cardwrapper_stop_app.cxx Checks that CardWrapper stops promptly in interrupt
+ * and hybrid mode, with and without a drain of the DMA buffers and with or without traffic,
+ * on a software card whose interrupt wait never times out, like the one of the FELIX driver.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#include "CardWrapper.hpp"
+
+#include "logging/Logging.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+using namespace dunedaq::flxlibs;
+
+namespace {
+
+constexpr auto stop_limit = std::chrono::seconds(5);
+
+int failures = 0;
+
+void
+check(bool condition, const std::string& what)
+{
+  if (!condition) {
+    TLOG() << "FAILED: " << what;
+    ++failures;
+  }
+}
+
+// Stops the card, and gives up on the whole test if stop doesn't return in time: a stop
+// stuck in the interrupt wait never returns
+double
+timed_stop(CardWrapper& flx, const std::string& mode)
+{
+  nlohmann::json cmd_params = "{}"_json;
+  std::mutex mutex;
+  std::condition_variable stopped_cv;
+  bool stopped = false;
+  std::thread watchdog([&]() {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!stopped_cv.wait_for(lock, stop_limit, [&] { return stopped; })) {
+      TLOG() << "FAILED: " << mode << ": stop didn't return within " << stop_limit.count() << " s";
+      std::_Exit(EXIT_FAILURE);
+    }
+  });
+  auto t0 = std::chrono::steady_clock::now();
+  flx.stop(cmd_params);
+  double stop_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopped = true;
+  }
+  stopped_cv.notify_all();
+  watchdog.join();
+  return stop_ms;
+}
+
+void
+check_stop(const std::string& mode, nlohmann::json conf, size_t drain_timeout_ms)
+{
+  nlohmann::json cmd_params = "{}"_json;
+  conf["card_backend"] = "software";
+  conf["chunk_trailer_size"] = 32;
+  conf["dma_memory_size_gb"] = 1;
+  conf["sw_irq_wait_timeout"] = 0;
+  conf["drain_timeout"] = drain_timeout_ms;
+
+  CardWrapper flx;
+  std::atomic<size_t> blocks{ 0 };
+  std::function<void(uint64_t)> count_block_addr = [&](uint64_t /*block_addr*/) { blocks++; }; // NOLINT
+  flx.set_block_addr_handler(count_block_addr);
+  flx.init(cmd_params);
+  flx.configure(conf);
+  flx.start(cmd_params);
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  double stop_ms = timed_stop(flx, mode);
+  check(stop_ms < static_cast<double>(drain_timeout_ms) + 500., mode + ": stop took " + std::to_string(stop_ms) + " ms");
+  TLOG() << mode << ": " << blocks.load() << " blocks, stopped in " << stop_ms << " ms";
+  flx.scrap(cmd_params);
+}
+
+} // namespace
+
+int
+main(int /*argc*/, char** /*argv[]*/)
+{
+  check_stop("interrupt, drain", { { "interrupt_mode", true }, { "sw_block_rate", 1000 } }, 100);
+  // One block a second: the DMA threads wait for an interrupt when stop comes
+  check_stop("interrupt, no traffic", { { "interrupt_mode", true }, { "sw_block_rate", 1 } }, 0);
+  check_stop("interrupt, no traffic, drain", { { "interrupt_mode", true }, { "sw_block_rate", 1 } }, 100);
+  check_stop("hybrid, no traffic", { { "hybrid_mode", true }, { "sw_block_rate", 1 } }, 0);
+
+  TLOG() << (failures == 0 ? "All checks passed" : std::to_string(failures) + " checks failed");
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,268 @@
+/**
+ * @file test_dma_lease_app.cxx Checks that held and leased blocks of a DMA buffer keep the
+ * read pointer back, that chunks are leased or copied as expected, and compares the cost
+ * of a leased chunk to a copied one. Then fills the DMA buffer of a CardWrapper on the
+ * software backend against a leased block, and checks that data flows again once the
+ * lease is dropped, in poll, interrupt and interrupt dispatcher mode, and that a buffer
+ * scrapped with a lease isn't reused before the lease is dropped.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#include "CardWrapper.hpp"
+#include "flxlibs/AvailableParserOperations.hpp"
+#include "flxlibs/DmaLeaseTable.hpp"
+
+#include "logging/Logging.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace dunedaq::flxlibs;
+
+namespace {
+
+constexpr size_t block_size = 4096;
+constexpr size_t num_blocks = 1024;
+
+int failures = 0;
+
+void
+check(bool condition, const std::string& what)
+{
+  if (!condition) {
+    TLOG() << "FAILED: " << what;
+    ++failures;
+  }
+}
+
+uint64_t // NOLINT(build/unsigned)
+block_addr(const std::vector<char>& buffer, size_t block)
+{
+  return reinterpret_cast<uint64_t>(buffer.data() + block * block_size); // NOLINT
+}
+
+template<class Make>
+double
+ns_per_chunk(size_t chunks, Make&& make)
+{
+  auto t0 = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < chunks; ++i) {
+    LeasedChunk chunk = make(i);
+    check(chunk.size != 0, "timed chunk is empty");
+  }
+  auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+  return elapsed / static_cast<double>(chunks);
+}
+
+// Block count once it stopped growing for 200 ms, or after the timeout
+size_t
+settled_count(const std::atomic<size_t>& counter, std::chrono::seconds timeout)
+{
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  size_t last = counter.load();
+  while (std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    size_t now = counter.load();
+    if (now == last) {
+      break;
+    }
+    last = now;
+  }
+  return last;
+}
+
+// The software card fills the buffer up to a block leased by the handler, and continues once
+// the lease is dropped, without new data arriving in between
+void
+check_stall_and_resume(CardWrapper& flx, const std::string& mode, nlohmann::json conf)
+{
+  nlohmann::json cmd_params = "{}"_json;
+  conf["card_backend"] = "software";
+  conf["zero_copy_chunks"] = true;
+  conf["chunk_trailer_size"] = 32;
+  conf["dma_memory_size_gb"] = 1;
+  conf["lease_timeout"] = 100;
+  flx.configure(conf);
+  DmaLeaseTable* table = flx.get_lease_table(0);
+  check(table != nullptr, mode + ": no lease table with zero_copy_chunks");
+  if (table == nullptr) {
+    flx.scrap(cmd_params);
+    return;
+  }
+
+  // Holds spans like the router and releases them like the parsers, but leases the first block
+  std::atomic<size_t> blocks{ 0 };
+  std::atomic<bool> leased_once{ false };
+  std::mutex lease_mutex;
+  std::shared_ptr<const char> lease;
+  std::function<size_t(uint64_t, size_t)> handle_span = [&](uint64_t first_block_addr, size_t count) { // NOLINT
+    table->hold_span(first_block_addr, count);
+    if (!leased_once.exchange(true)) {
+      std::lock_guard<std::mutex> lock(lease_mutex);
+      lease = table->lease(reinterpret_cast<const char*>(first_block_addr)); // NOLINT
+    }
+    for (size_t i = 0; i < count; ++i) {
+      table->release(first_block_addr + i * CardWrapper::get_block_size());
+    }
+    blocks += count;
+    return 0;
+  };
+  flx.set_block_span_handler(0, handle_span);
+
+  flx.start(cmd_params);
+  size_t stalled = settled_count(blocks, std::chrono::seconds(20));
+  size_t ring_blocks = table->num_blocks();
+  check(stalled > ring_blocks / 2 && stalled < ring_blocks, mode + ": buffer didn't fill up to the leased block");
+  check(table->outstanding() == 1, mode + ": holds other than the lease outstanding");
+  {
+    std::lock_guard<std::mutex> lock(lease_mutex);
+    lease.reset();
+  }
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (blocks.load() < stalled + ring_blocks && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  size_t resumed = blocks.load() - stalled;
+  check(resumed >= ring_blocks, mode + ": data didn't flow again after the lease was dropped");
+  TLOG() << mode << ": stalled after " << stalled << " of " << ring_blocks << " blocks with a lease, " << resumed
+         << " blocks after its release";
+  flx.stop(cmd_params);
+  flx.scrap(cmd_params);
+}
+
+// A lease held over scrap keeps its buffer from the next configuration
+void
+check_scrap_with_lease(CardWrapper& flx)
+{
+  nlohmann::json cmd_params = "{}"_json;
+  nlohmann::json conf = { { "card_backend", "software" },
+                          { "zero_copy_chunks", true },
+                          { "chunk_trailer_size", 32 },
+                          { "dma_memory_size_gb", 1 },
+                          { "lease_timeout", 100 } };
+  flx.configure(conf);
+  std::shared_ptr<const char> lease;
+  std::function<size_t(uint64_t, size_t)> handle_span = [&](uint64_t first_block_addr, size_t count) { // NOLINT
+    DmaLeaseTable* table = DmaLeaseTable::find(reinterpret_cast<const char*>(first_block_addr)); // NOLINT
+    table->hold_span(first_block_addr, count);
+    if (lease == nullptr) {
+      lease = table->lease(reinterpret_cast<const char*>(first_block_addr)); // NOLINT
+    }
+    for (size_t i = 0; i < count; ++i) {
+      table->release(first_block_addr + i * CardWrapper::get_block_size());
+    }
+    return 0;
+  };
+  flx.set_block_span_handler(0, handle_span);
+  flx.start(cmd_params);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  flx.stop(cmd_params);
+  check(lease != nullptr, "no block leased before scrap");
+  flx.scrap(cmd_params);
+  check(DmaLeaseTable::find(lease.get()) == nullptr, "lease table of a scrapped buffer still registered");
+
+  flx.configure(conf);
+  check(DmaLeaseTable::find(lease.get()) == nullptr, "buffer with a lease reused by the next configuration");
+  flx.scrap(cmd_params);
+  lease.reset();
+  flx.configure(conf);
+  flx.scrap(cmd_params);
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+  // Usage: flxlibs_test_dma_lease [timed chunks]
+  const size_t timed_chunks = (argc > 1) ? std::stoul(argv[1]) : 1000000;
+  std::vector<char> buffer(num_blocks * block_size, 1);
+  std::vector<char> outside(block_size, 2);
+  constexpr size_t segment = DmaLeaseTable::s_segment_blocks;
+
+  {
+    DmaLeaseTable table(block_addr(buffer, 0), buffer.size(), block_size);
+    check(DmaLeaseTable::find(buffer.data() + 5 * block_size + 17) == &table, "buffer address not found");
+    check(DmaLeaseTable::find(outside.data()) == nullptr, "address outside the buffer found");
+
+    // Nothing held: the read pointer moves all the way, also over the wraparound
+    check(table.hold_back(0, 100) == 100, "free buffer holds back");
+    check(table.hold_back(1000, 40) == 40, "free buffer holds back over the wraparound");
+
+    // The router holds a span, the parser releases it block by block
+    table.hold_span(block_addr(buffer, 3 * segment), 2 * segment);
+    check(table.outstanding() == 2 * segment, "span holds not counted");
+    check(table.hold_back(0, 100) == 3 * segment, "read pointer not stopped at the held segment");
+    for (size_t b = 3 * segment; b < 4 * segment; ++b) {
+      table.release(block_addr(buffer, b));
+    }
+    check(table.hold_back(0, 100) == 4 * segment, "read pointer not moved past the released segment");
+
+    // A chunk leased from a held block outlives the router hold
+    const char* data = buffer.data() + (4 * segment + 2) * block_size + 16;
+    LeasedChunk leased = parsers::lease_or_copy(data, 64);
+    check(leased.leased && leased.data.get() == data, "chunk in the buffer not leased");
+    for (size_t b = 4 * segment; b < 5 * segment; ++b) {
+      table.release(block_addr(buffer, b));
+    }
+    check(table.hold_back(0, 100) == 4 * segment, "read pointer moved past a leased block");
+    LeasedChunk copy = leased; // a second reference downstream
+    leased = LeasedChunk();
+    check(table.hold_back(0, 100) == 4 * segment, "lease released with a reference left");
+    copy = LeasedChunk();
+    check(table.hold_back(0, 100) == 100 && table.outstanding() == 0, "lease not released");
+
+    // Outside of any buffer with a lease table, chunks are copied
+    LeasedChunk copied = parsers::lease_or_copy(outside.data(), 64);
+    check(!copied.leased && copied.data.get() != outside.data() && copied.data.get()[63] == 2, "chunk not copied");
+
+    // Timing: lease against copy of chunks of the same size, single subchunk chunks only
+    for (size_t size : { 64, 472, 2048 }) {
+      const size_t chunks_per_block = block_size / size;
+      auto chunk_at = [&](size_t i) {
+        return buffer.data() + (i % num_blocks) * block_size + (i / num_blocks % chunks_per_block) * size;
+      };
+      table.hold_span(block_addr(buffer, 0), num_blocks);
+      double lease_ns = ns_per_chunk(timed_chunks, [&](size_t i) { return parsers::lease_or_copy(chunk_at(i), size); });
+      for (size_t b = 0; b < num_blocks; ++b) {
+        table.release(block_addr(buffer, b));
+      }
+      double copy_ns = ns_per_chunk(timed_chunks, [&](size_t i) {
+        LeasedChunk chunk;
+        std::shared_ptr<char> data(new char[size], std::default_delete<char[]>());
+        std::memcpy(data.get(), chunk_at(i), size);
+        chunk.data = std::move(data);
+        chunk.size = size;
+        return chunk;
+      });
+      TLOG() << size << " B chunks: leased " << lease_ns << " ns/chunk, copied " << copy_ns << " ns/chunk";
+    }
+    check(table.outstanding() == 0, "holds left after timing");
+  }
+  check(DmaLeaseTable::find(buffer.data()) == nullptr, "lease table still registered after destruction");
+
+  {
+    CardWrapper flx;
+    flx.init("{}"_json);
+    check_stall_and_resume(flx, "poll", { { "interrupt_mode", false } });
+    check_stall_and_resume(flx, "interrupt", { { "interrupt_mode", true } });
+    check_stall_and_resume(flx, "interrupt dispatcher", { { "interrupt_mode", true }, { "irq_dispatcher_threads", 1 } });
+    check_scrap_with_lease(flx);
+  }
+
+  TLOG() << (failures == 0 ? "All checks passed" : std::to_string(failures) + " checks failed");
+  return failures == 0 ? 0 : 1;
+}
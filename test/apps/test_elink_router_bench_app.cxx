@@ -0,0 +1,124 @@
+/**
+ * @file test_elink_router_bench_app.cxx Benchmark of the elink router: std::map
+ * lookup and virtual enqueue versus the direct-indexed ElinkRoutingTable, for
+ * 5, 12 and 64 elinks.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#include "CardWrapper.hpp"
+#include "ElinkConcept.hpp"
+#include "ElinkRoutingTable.hpp"
+
+#include "logging/Logging.hpp"
+
+#include "packetformat/block_format.hpp"
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace dunedaq::flxlibs;
+
+namespace {
+
+// Counts the blocks it gets instead of queueing them for a parser
+class CountingElink : public ElinkConcept
+{
+public:
+  void init(const nlohmann::json& /*args*/, const size_t /*block_queue_capacity*/) override {}
+  void set_sink(const std::string& /*sink_name*/) override {}
+  void conf(const nlohmann::json& /*args*/, size_t /*block_size*/, bool /*is_32b_trailers*/) override {}
+  void start(const nlohmann::json& /*args*/) override {}
+  void stop(const nlohmann::json& /*args*/) override {}
+  void scrap(const nlohmann::json& /*args*/) override {}
+  void get_info(dunedaq::opmonlib::InfoCollector& /*ci*/, int /*level*/) override {}
+
+  bool queue_in_block_address(uint64_t /*block_addr*/) override // NOLINT(build/unsigned)
+  {
+    ++m_blocks;
+    return true;
+  }
+  static bool enqueue(ElinkConcept* elink, uint64_t block_addr) // NOLINT(build/unsigned)
+  {
+    return static_cast<CountingElink*>(elink)->CountingElink::queue_in_block_address(block_addr);
+  }
+  enqueue_fn_t get_enqueue_fn() const override { return &CountingElink::enqueue; }
+  size_t parse_queued_blocks(size_t /*max_blocks*/) override { return 0; }
+  size_t queued_blocks() const override { return 0; }
+
+  size_t m_blocks{ 0 };
+};
+
+} // namespace
+
+int
+main(int /*argc*/, char** /*argv[]*/)
+{
+  constexpr size_t block_size = CardWrapper::get_block_size();
+  constexpr size_t num_blocks = 16384; // 64 MB ring
+  constexpr size_t num_passes = 100;
+  std::vector<char> ring(num_blocks * block_size);
+  const uint64_t ring_start = reinterpret_cast<uint64_t>(ring.data()); // NOLINT
+
+  for (int num_elinks : { 5, 12, 64 }) {
+    // Tags as in FelixCardReader, link * 64, compressed to fit the 11 bit field for 64 elinks
+    const unsigned tag_step = (num_elinks <= 32) ? 64 : 32;
+    std::vector<std::unique_ptr<CountingElink>> elinks;
+    std::map<int, ElinkConcept*> elink_map;
+    auto table = std::make_unique<ElinkRoutingTable>();
+    for (int i = 0; i < num_elinks; ++i) {
+      elinks.push_back(std::make_unique<CountingElink>());
+      elink_map[i * tag_step] = elinks.back().get();
+      table->add(i * tag_step, elinks.back().get());
+    }
+    for (size_t i = 0; i < num_blocks; ++i) {
+      auto* block = reinterpret_cast<felix::packetformat::block*>(ring.data() + i * block_size); // NOLINT
+      block->elink = (i % num_elinks) * tag_step;
+    }
+
+    auto run = [&](auto&& route) {
+      auto t0 = std::chrono::steady_clock::now();
+      for (size_t pass = 0; pass < num_passes; ++pass) {
+        for (size_t i = 0; i < num_blocks; ++i) {
+          uint64_t block_addr = ring_start + i * block_size; // NOLINT(build/unsigned)
+          const auto* block = felix::packetformat::block_from_bytes(reinterpret_cast<const char*>(block_addr)); // NOLINT
+          route(block->elink, block_addr);
+        }
+      }
+      auto t1 = std::chrono::steady_clock::now();
+      return std::chrono::duration<double, std::nano>(t1 - t0).count() / (num_passes * num_blocks);
+    };
+    auto map_route = [&](unsigned tag, uint64_t block_addr) { // NOLINT(build/unsigned)
+      auto elink = elink_map.find(tag);
+      if (elink != elink_map.end()) {
+        elink->second->queue_in_block_address(block_addr);
+      }
+    };
+    auto table_route = [&](unsigned tag, uint64_t block_addr) { // NOLINT(build/unsigned)
+      const auto& route = table->route(tag);
+      if (route.elink != nullptr) {
+        route.enqueue(route.elink, block_addr);
+      }
+    };
+
+    run(map_route); // warm up
+    double map_ns = run(map_route);
+    double table_ns = run(table_route);
+
+    size_t routed = 0;
+    for (auto& elink : elinks) {
+      routed += elink->m_blocks;
+    }
+    TLOG() << num_elinks << " elinks: std::map router " << map_ns << " ns/block, routing table " << table_ns
+           << " ns/block (" << routed << " blocks routed)";
+    if (routed != 3 * num_passes * num_blocks) {
+      TLOG() << "Blocks were lost by a router!";
+      return 1;
+    }
+  }
+  return 0;
+}
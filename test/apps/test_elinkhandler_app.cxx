@@ -7,8 +7,8 @@
  * received with this code.
  */
 #include "CardWrapper.hpp"
-#include "CreateElink.hpp"
 #include "ElinkConcept.hpp"
+#include "ElinkModel.hpp"
 #include "flxlibs/AvailableParserOperations.hpp"
 
 #include "logging/Logging.hpp"
@@ -50,9 +50,9 @@ main(int /*argc*/, char** /*argv[]*/)
   CardWrapper flx;
   std::map<int, std::unique_ptr<ElinkConcept>> elinks;
 
-  // 5 elink handlers
+  // 5 elink handlers, with runtime handlers so that elink-0 can be modified below
   for (int i = 0; i < 5; ++i) {
-    elinks[i * 64] = createElinkModel("wib");
+    elinks[i * 64] = std::make_unique<ElinkModel<types::WIB_SUPERCHUNK_STRUCT>>();
     auto& handler = elinks[i * 64];
     handler->init(cmd_params, 100000);
     handler->conf(cmd_params, 4096, true);
@@ -0,0 +1,138 @@
+/**
+ * @file test_interrupt_dispatcher_app.cxx Test application for the
+ * InterruptDispatcher. Fake interrupt sources are eventfds fired from a
+ * trigger thread; checks that every interrupt is served, that handlers of a
+ * source never overlap, and that removing a source waits for its handler.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#include "InterruptDispatcher.hpp"
+
+#include "logging/Logging.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+using namespace dunedaq::flxlibs;
+
+namespace {
+
+// A fake DMA ring: the trigger thread "writes blocks" and fires the interrupt,
+// the handler consumes everything written so far.
+struct FakeRing
+{
+  int fd{ -1 };
+  std::atomic<uint64_t> written{ 0 };  // NOLINT(build/unsigned)
+  std::atomic<uint64_t> consumed{ 0 }; // NOLINT(build/unsigned)
+  std::atomic<bool> in_handler{ false };
+  std::atomic<size_t> overlaps{ 0 };
+  std::atomic<size_t> calls{ 0 };
+  InterruptDispatcher::source_id_t id{ -1 };
+};
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+  // Usage: flxlibs_test_interrupt_dispatcher [rings] [workers] [seconds]
+  const size_t num_rings = (argc > 1) ? std::stoul(argv[1]) : 12;
+  const size_t num_workers = (argc > 2) ? std::stoul(argv[2]) : 2;
+  const int seconds = (argc > 3) ? std::stoi(argv[3]) : 2;
+
+  InterruptDispatcher dispatcher(num_workers, "test-irq");
+  std::vector<std::unique_ptr<FakeRing>> rings;
+  for (size_t i = 0; i < num_rings; ++i) {
+    auto ring = std::make_unique<FakeRing>();
+    ring->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    FakeRing* r = ring.get();
+    ring->id = dispatcher.add_source(ring->fd, [r]() {
+      if (r->in_handler.exchange(true)) {
+        r->overlaps++;
+      }
+      r->calls++;
+      std::this_thread::sleep_for(std::chrono::microseconds(20)); // some block processing
+      r->consumed.store(r->written.load());
+      r->in_handler.store(false);
+    });
+    rings.push_back(std::move(ring));
+  }
+
+  TLOG() << "Firing interrupts of " << num_rings << " fake rings for " << seconds << "s with " << num_workers
+         << " workers...";
+  std::atomic<bool> firing{ true };
+  size_t interrupts = 0;
+  std::thread trigger([&]() {
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<size_t> pick(0, num_rings - 1);
+    uint64_t one = 1; // NOLINT(build/unsigned)
+    while (firing.load()) {
+      auto& ring = rings[pick(gen)];
+      ring->written++;
+      [[maybe_unused]] auto ret = write(ring->fd, &one, sizeof(one));
+      ++interrupts;
+      std::this_thread::sleep_for(std::chrono::microseconds(5));
+    }
+  });
+  std::this_thread::sleep_for(std::chrono::seconds(seconds));
+  firing.store(false);
+  trigger.join();
+
+  // Every ring must catch up with its last interrupt
+  bool ok = true;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+  for (auto& ring : rings) {
+    while (ring->consumed.load() != ring->written.load() && std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (ring->consumed.load() != ring->written.load()) {
+      TLOG() << "Ring with fd " << ring->fd << " lost interrupts: written " << ring->written << " consumed "
+             << ring->consumed;
+      ok = false;
+    }
+    if (ring->overlaps.load() != 0) {
+      TLOG() << "Ring with fd " << ring->fd << " had " << ring->overlaps << " overlapping handler calls!";
+      ok = false;
+    }
+  }
+
+  // Removing a source returns only after its handler finished, and no calls follow
+  auto& first = rings.front();
+  dispatcher.remove_source(first->id);
+  size_t calls_after_removal = first->calls.load();
+  bool in_handler_after_removal = first->in_handler.load();
+  uint64_t one = 1; // NOLINT(build/unsigned)
+  [[maybe_unused]] auto ret = write(first->fd, &one, sizeof(one));
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  if (in_handler_after_removal || first->calls.load() != calls_after_removal) {
+    TLOG() << "Handler of a removed source was still called!";
+    ok = false;
+  }
+
+  size_t calls = 0;
+  for (auto& ring : rings) {
+    calls += ring->calls.load();
+  }
+  TLOG() << "Interrupts fired: " << interrupts << ", handler calls: " << calls
+         << ", dispatcher wakeups: " << dispatcher.get_num_wakeups() << ", events: " << dispatcher.get_num_events();
+  TLOG() << "Interrupts combined per handler call: " << static_cast<double>(interrupts) / calls;
+
+  for (auto& ring : rings) {
+    if (ring->id >= 0 && ring.get() != first.get()) {
+      dispatcher.remove_source(ring->id);
+    }
+    close(ring->fd);
+  }
+  TLOG() << (ok ? "Test passed." : "Test FAILED.");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,95 @@
+/**
+ * @file test_parse_batch_bench_app.cxx Benchmark of the parser's queue drain: one
+ * block address per read with a run marker check per block, versus batches of
+ * addresses with the next block prefetched.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#include "BlockBatch.hpp"
+#include "CardWrapper.hpp"
+
+#include "logging/Logging.hpp"
+
+#include <folly/ProducerConsumerQueue.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace dunedaq::flxlibs;
+
+int
+main(int argc, char* argv[])
+{
+  // Usage: flxlibs_test_parse_batch_bench [elinks interleaved in the DMA buffer]
+  const size_t num_elinks = (argc > 1) ? std::stoul(argv[1]) : 5;
+  constexpr size_t block_size = CardWrapper::get_block_size();
+  constexpr size_t num_blocks = 65536; // ring larger than the last level cache
+  constexpr size_t queue_blocks = 4096;
+  constexpr size_t num_passes = 20;
+
+  std::vector<char> ring(num_blocks * block_size, 1);
+  const uint64_t ring_start = reinterpret_cast<uint64_t>(ring.data()); // NOLINT(build/unsigned)
+  folly::ProducerConsumerQueue<uint64_t> queue(queue_blocks + 1);  // NOLINT(build/unsigned)
+  std::atomic<bool> run_marker{ true };
+
+  // The parser reads the whole block, like the chunk copies of the block parser
+  uint64_t checksum = 0; // NOLINT(build/unsigned)
+  auto parse = [&](uint64_t block_addr) { // NOLINT(build/unsigned)
+    const auto* words = reinterpret_cast<const uint64_t*>(block_addr); // NOLINT
+    uint64_t sum = 0;                                                  // NOLINT(build/unsigned)
+    for (size_t i = 0; i < block_size / sizeof(uint64_t); ++i) {
+      sum += words[i];
+    }
+    checksum += sum;
+  };
+
+  // Blocks of one elink, every num_elinks-th block of the ring, queued as the router does
+  auto run = [&](size_t batch_blocks) {
+    size_t next_block = 0;
+    size_t parsed = 0;
+    size_t wakeups = 0;
+    std::chrono::nanoseconds parse_time{ 0 };
+    for (size_t pass = 0; pass < num_passes * num_blocks / num_elinks / queue_blocks; ++pass) {
+      for (size_t i = 0; i < queue_blocks; ++i) {
+        queue.write(ring_start + next_block * block_size);
+        next_block = (next_block + num_elinks) % num_blocks;
+      }
+      auto t0 = std::chrono::steady_clock::now();
+      if (batch_blocks == 0) {
+        uint64_t block_addr; // NOLINT(build/unsigned)
+        while (run_marker.load() && queue.read(block_addr)) {
+          parse(block_addr);
+          ++parsed;
+          ++wakeups;
+        }
+      } else {
+        while (run_marker.load()) {
+          size_t batch = parse_block_batch(queue, batch_blocks, block_size, parse);
+          if (batch == 0) {
+            break;
+          }
+          parsed += batch;
+          ++wakeups;
+        }
+      }
+      parse_time += std::chrono::steady_clock::now() - t0;
+    }
+    TLOG() << (batch_blocks == 0 ? std::string("Per block reads") : "Batches of " + std::to_string(batch_blocks))
+           << ": " << static_cast<double>(parse_time.count()) / parsed << " ns/block, "
+           << static_cast<double>(parsed) / wakeups << " blocks per pass";
+  };
+
+  TLOG() << "Block size " << block_size << " B, " << num_elinks << " elinks interleaved";
+  run(0); // warm up
+  run(0);
+  for (size_t batch_blocks : { 1, 16, 64, 256 }) {
+    run(batch_blocks);
+  }
+  TLOG() << "Checksum " << checksum;
+  return 0;
+}
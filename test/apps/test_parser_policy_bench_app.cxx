@@ -0,0 +1,95 @@
+/**
+ * @file test_parser_policy_bench_app.cxx Benchmark of the per chunk dispatch of the
+ * block parser: DefaultParserImpl with its handler bound to a std::function, versus
+ * PolicyParserImpl with the same handler as a policy type.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#include "DefaultParserImpl.hpp"
+#include "PolicyParserImpl.hpp"
+
+#include "logging/Logging.hpp"
+
+#include "packetformat/block_format.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace dunedaq::flxlibs;
+
+namespace {
+
+// The handler of both parsers: reads the chunk, as a copy into a sink would
+struct SumLengths
+{
+  uint64_t sum{ 0 }; // NOLINT(build/unsigned)
+  void operator()(const felix::packetformat::shortchunk& shortchunk) { sum += shortchunk.length + shortchunk.data[0]; }
+};
+
+// Calls the operations the way BlockParser<Ops> does for every chunk of a block
+template<class Ops>
+__attribute__((noinline)) void
+process_chunks(Ops& ops, const std::vector<felix::packetformat::shortchunk>& chunks)
+{
+  for (const auto& shortchunk : chunks) {
+    ops.shortchunk_processed(shortchunk);
+  }
+}
+
+template<class Ops>
+double
+time_ns_per_chunk(Ops& ops, const std::vector<felix::packetformat::shortchunk>& chunks, size_t passes)
+{
+  auto t0 = std::chrono::steady_clock::now();
+  for (size_t pass = 0; pass < passes; ++pass) {
+    process_chunks(ops, chunks);
+  }
+  auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+  return elapsed / static_cast<double>(chunks.size() * passes);
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+  // Usage: flxlibs_test_parser_policy_bench [passes over 1 M chunks]
+  const size_t passes = (argc > 1) ? std::stoul(argv[1]) : 50;
+  constexpr size_t num_chunks = 1 << 20;
+
+  std::vector<char> payload(num_chunks, 1);
+  std::vector<felix::packetformat::shortchunk> chunks(num_chunks);
+  for (size_t i = 0; i < num_chunks; ++i) {
+    chunks[i].data = payload.data() + i;
+    chunks[i].length = static_cast<unsigned>(i % 64);
+  }
+
+  SumLengths bound;
+  DefaultParserImpl default_parser;
+  default_parser.process_shortchunk_func = [&bound](const felix::packetformat::shortchunk& shortchunk) {
+    bound(shortchunk);
+  };
+  PolicyParserImpl<parsers::Discard, SumLengths> policy_parser;
+
+  time_ns_per_chunk(default_parser, chunks, 1); // warm up
+  time_ns_per_chunk(policy_parser, chunks, 1);
+  bound.sum = 0;
+  policy_parser.shortchunk_policy().sum = 0;
+
+  double default_ns = time_ns_per_chunk(default_parser, chunks, passes);
+  double policy_ns = time_ns_per_chunk(policy_parser, chunks, passes);
+
+  TLOG() << "std::function handler: " << default_ns << " ns/chunk";
+  TLOG() << "Policy handler:        " << policy_ns << " ns/chunk (" << default_ns / policy_ns << "x)";
+  if (bound.sum != policy_parser.shortchunk_policy().sum ||
+      default_parser.get_stats().short_ctr.load() != policy_parser.get_stats().short_ctr.load()) {
+    TLOG() << "Parsers disagree: " << bound.sum << " vs " << policy_parser.shortchunk_policy().sum;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,188 @@
+/**
+ * @file test_parser_worker_pool_app.cxx Parses skewed elink traffic with 1, 2 and 4
+ * parser workers, checks that every elink's blocks are parsed once, in order and by
+ * one worker at a time, and reports the throughput and the stolen blocks. Then sends
+ * sparse blocks to the parked workers and reports the enqueue to parse latency.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#include "ElinkConcept.hpp"
+#include "ParserWorkerPool.hpp"
+
+#include "logging/Logging.hpp"
+
+#include <folly/ProducerConsumerQueue.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace dunedaq::flxlibs;
+
+namespace {
+
+// Queues enqueue timestamps instead of block addresses, checks their order and measures
+// the enqueue to parse latency when parsing
+class SequenceElink : public ElinkConcept
+{
+public:
+  static constexpr size_t s_queue_capacity = 100000;
+
+  SequenceElink()
+    : m_queue(s_queue_capacity)
+  {}
+
+  void init(const nlohmann::json& /*args*/, const size_t /*block_queue_capacity*/) override {}
+  void set_sink(const std::string& /*sink_name*/) override {}
+  void conf(const nlohmann::json& /*args*/, size_t /*block_size*/, bool /*is_32b_trailers*/) override {}
+  void start(const nlohmann::json& /*args*/) override {}
+  void stop(const nlohmann::json& /*args*/) override {}
+  void scrap(const nlohmann::json& /*args*/) override {}
+  void get_info(dunedaq::opmonlib::InfoCollector& /*ci*/, int /*level*/) override {}
+
+  bool queue_in_block_address(uint64_t block_addr) override // NOLINT(build/unsigned)
+  {
+    return m_queue.write(block_addr);
+  }
+  static bool enqueue(ElinkConcept* elink, uint64_t block_addr) // NOLINT(build/unsigned)
+  {
+    return static_cast<SequenceElink*>(elink)->SequenceElink::queue_in_block_address(block_addr);
+  }
+  enqueue_fn_t get_enqueue_fn() const override { return &SequenceElink::enqueue; }
+
+  size_t parse_queued_blocks(size_t max_blocks) override
+  {
+    if (m_in_parse.exchange(true)) {
+      m_errors++;
+    }
+    size_t parsed = 0;
+    uint64_t stamp; // NOLINT(build/unsigned)
+    while (parsed < max_blocks && m_queue.read(stamp)) {
+      if (stamp <= m_last) {
+        m_errors++;
+      }
+      m_last = stamp;
+      uint64_t latency = now_ns() - stamp; // NOLINT(build/unsigned)
+      m_latency_sum_ns += latency;
+      m_latency_max_ns = std::max(m_latency_max_ns, latency);
+      // About the parse time of a 4 kB block
+      auto t0 = std::chrono::steady_clock::now();
+      while (std::chrono::steady_clock::now() - t0 < std::chrono::nanoseconds(300)) {
+      }
+      ++parsed;
+    }
+    m_parsed.fetch_add(parsed, std::memory_order_release);
+    m_in_parse.store(false);
+    return parsed;
+  }
+  size_t queued_blocks() const override { return m_queue.sizeGuess(); }
+
+  static uint64_t now_ns() // NOLINT(build/unsigned)
+  {
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+  }
+
+  folly::ProducerConsumerQueue<uint64_t> m_queue; // NOLINT(build/unsigned)
+  uint64_t m_last{ 0 };                           // NOLINT(build/unsigned)
+  uint64_t m_latency_sum_ns{ 0 };                 // NOLINT(build/unsigned)
+  uint64_t m_latency_max_ns{ 0 };                 // NOLINT(build/unsigned)
+  std::atomic<bool> m_in_parse{ false };
+  std::atomic<size_t> m_parsed{ 0 };
+  std::atomic<size_t> m_errors{ 0 };
+};
+
+} // namespace
+
+int
+main(int /*argc*/, char** /*argv[]*/)
+{
+  constexpr size_t num_elinks = 10;
+  constexpr size_t num_blocks = 400000;
+  constexpr size_t num_sparse_blocks = 2000;
+  constexpr auto sparse_interval = std::chrono::microseconds(100);
+  int ret = 0;
+
+  for (size_t num_workers : { 1, 2, 4 }) {
+    std::vector<std::unique_ptr<SequenceElink>> elinks;
+    std::vector<ElinkConcept*> pool_elinks;
+    for (size_t i = 0; i < num_elinks; ++i) {
+      elinks.push_back(std::make_unique<SequenceElink>());
+      pool_elinks.push_back(elinks.back().get());
+    }
+    ParserWorkerPool pool(pool_elinks, num_workers, 64, 2000, 100, {}, 0, 0);
+    for (auto* elink : pool_elinks) {
+      elink->set_parser_pool(&pool);
+      pool.attach(elink);
+    }
+
+    // Enqueues as the router does, with the fence before the wakeup check
+    std::vector<uint64_t> last_stamp(num_elinks, 0); // NOLINT(build/unsigned)
+    std::vector<size_t> sent(num_elinks, 0);
+    auto send = [&](size_t e) {
+      last_stamp[e] = std::max(last_stamp[e] + 1, SequenceElink::now_ns());
+      while (!elinks[e]->queue_in_block_address(last_stamp[e])) {
+        std::this_thread::yield();
+      }
+      ++sent[e];
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      elinks[e]->notify_parser();
+    };
+    auto wait_parsed = [&]() {
+      for (size_t e = 0; e < num_elinks; ++e) {
+        while (elinks[e]->m_parsed.load(std::memory_order_acquire) < sent[e]) {
+          std::this_thread::yield();
+        }
+      }
+    };
+
+    // Half of the blocks go to elink 0, the rest round robin
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < num_blocks; ++i) {
+      send((i % 2 == 0) ? 0 : (i / 2) % num_elinks);
+    }
+    wait_parsed();
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    // Sparse blocks find the workers parked
+    for (auto& elink : elinks) {
+      elink->m_latency_sum_ns = 0;
+      elink->m_latency_max_ns = 0;
+    }
+    for (size_t i = 0; i < num_sparse_blocks; ++i) {
+      std::this_thread::sleep_for(sparse_interval);
+      send(i % num_elinks);
+    }
+    wait_parsed();
+    uint64_t latency_sum_ns = 0; // NOLINT(build/unsigned)
+    uint64_t latency_max_ns = 0; // NOLINT(build/unsigned)
+    for (auto& elink : elinks) {
+      latency_sum_ns += elink->m_latency_sum_ns;
+      latency_max_ns = std::max(latency_max_ns, elink->m_latency_max_ns);
+    }
+    for (auto* elink : pool_elinks) {
+      pool.detach(elink);
+    }
+
+    size_t parsed = 0;
+    size_t errors = 0;
+    for (size_t e = 0; e < num_elinks; ++e) {
+      parsed += elinks[e]->m_parsed.load();
+      errors += elinks[e]->m_errors.load();
+    }
+    TLOG() << num_workers << " workers: " << num_blocks << " blocks in " << seconds * 1000 << " ms ("
+           << num_blocks / seconds / 1e6 << " M blocks/s), " << pool.get_num_blocks_stolen() << " stolen, " << errors
+           << " errors. Sparse blocks: enqueue to parse latency avg " << latency_sum_ns / 1e3 / num_sparse_blocks
+           << " us, max " << latency_max_ns / 1e3 << " us";
+    if (parsed != num_blocks + num_sparse_blocks || errors != 0) {
+      TLOG() << "Blocks were lost, reordered or parsed concurrently!";
+      ret = 1;
+    }
+  }
+  return ret;
+}
@@ -0,0 +1,143 @@
+/**
+ * @file test_software_card_backend_app.cxx Test application for the
+ * SoftwareCardBackend. Reads the blocks it generates with 16 and 32 bit trailers
+ * and checks that every block's trailer chain leads back to the block header, and
+ * that the subchunks add up to chunks of the configured size.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#include "FelixBlockFormat.hpp"
+#include "FelixDefinitions.hpp"
+#include "SoftwareCardBackend.hpp"
+
+#include "logging/Logging.hpp"
+
+#include "packetformat/block_format.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace dunedaq::flxlibs;
+
+namespace {
+
+constexpr size_t num_blocks = 64;
+constexpr size_t blocks_to_check = 20000;
+
+int failures = 0;
+
+void
+check(bool condition, const std::string& what)
+{
+  if (!condition) {
+    TLOG() << "FAILED: " << what;
+    ++failures;
+  }
+}
+
+struct ChunkState
+{
+  bool started{ false }; // the first subchunk of the current chunk was seen
+  size_t length{ 0 };
+};
+
+// Decodes the block from the back, then follows its subchunks from the front
+void
+check_block(const char* block, size_t block_size, size_t trailer_size, size_t chunk_size,
+            std::map<unsigned, ChunkState>& chunks)
+{
+  using namespace blockformat;
+  const auto* header = felix::packetformat::block_from_bytes(block);
+  check(header->sob == (trailer_size == 4 ? sob_32b_trailer : sob_16b_trailer), "wrong start of block marker");
+
+  std::vector<SubchunkTrailer> subchunks;
+  size_t pos = block_size;
+  while (pos > header_size) {
+    pos -= trailer_size;
+    SubchunkTrailer trailer;
+    if (trailer_size == 4) {
+      uint32_t word; // NOLINT(build/unsigned)
+      std::memcpy(&word, block + pos, sizeof(word));
+      trailer = decode_trailer_32b(word);
+    } else {
+      uint16_t word; // NOLINT(build/unsigned)
+      std::memcpy(&word, block + pos, sizeof(word));
+      trailer = decode_trailer_16b(word);
+    }
+    size_t padded = padded_length(trailer.length, trailer_size);
+    if (padded > pos - header_size) {
+      check(false, "trailer chain of elink " + std::to_string(header->elink) + " runs past the block header");
+      return;
+    }
+    pos -= padded;
+    subchunks.push_back(trailer);
+  }
+  check(pos == header_size, "trailer chain doesn't end at the block header");
+
+  auto& chunk = chunks[header->elink];
+  for (auto it = subchunks.rbegin(); it != subchunks.rend(); ++it) {
+    if (it->type == SubchunkType::kNull) {
+      continue;
+    }
+    if (it->type == SubchunkType::kFirst || it->type == SubchunkType::kBoth) {
+      check(!chunk.started, "chunk of elink " + std::to_string(header->elink) + " starts before the last ended");
+      chunk.started = true;
+      chunk.length = 0;
+    }
+    chunk.length += it->length;
+    if (it->type == SubchunkType::kLast || it->type == SubchunkType::kBoth) {
+      // The first chunk of a stream may have started before the first block checked
+      if (chunk.started) {
+        check(chunk.length == chunk_size, "chunk of " + std::to_string(chunk.length) + " bytes instead of " +
+                                            std::to_string(chunk_size));
+      }
+      chunk.started = false;
+    }
+  }
+}
+
+void
+check_trailers(size_t trailer_bits)
+{
+  felixcardreader::Conf cfg;
+  cfg.chunk_trailer_size = trailer_bits;
+  const size_t block_size = cfg.dma_block_size_kb * 1024UL;
+  const size_t trailer_size = trailer_bits == 32 ? 4 : 2;
+  std::vector<char> buffer(num_blocks * block_size);
+  const auto start = reinterpret_cast<uint64_t>(buffer.data()); // NOLINT
+
+  SoftwareCardBackend card(cfg);
+  card.dma_to_host(0, start, buffer.size(), 0);
+  std::map<unsigned, ChunkState> chunks;
+  size_t read_index = 0;
+  size_t checked = 0;
+  while (checked < blocks_to_check && failures == 0) {
+    size_t write_index = (card.current_address(0) - start) / block_size;
+    while (read_index != write_index && checked < blocks_to_check) {
+      check_block(buffer.data() + read_index * block_size, block_size, trailer_size, cfg.sw_chunk_size, chunks);
+      read_index = (read_index + 1) % num_blocks;
+      ++checked;
+    }
+    card.dma_set_ptr(0, start + read_index * block_size);
+  }
+  card.dma_stop(0);
+  TLOG() << "Checked " << checked << " blocks with " << trailer_bits << " bit trailers and " << cfg.sw_chunk_size
+         << " B chunks";
+}
+
+} // namespace
+
+int
+main(int /*argc*/, char** /*argv[]*/)
+{
+  check_trailers(16);
+  check_trailers(32);
+
+  TLOG() << (failures == 0 ? "All checks passed" : std::to_string(failures) + " checks failed");
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,81 @@
+/**
+ * @file test_software_cardwrapper_app.cxx Test application for
+ * CardWrapper on top of the software card backend. Runs the DMA block
+ * processing without a FELIX card and reports the achieved block rate.
+ *
+ * This is part of the DUNE DAQ Application Framework, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#include "CardWrapper.hpp"
+
+#include "logging/Logging.hpp"
+
+#include "packetformat/block_format.hpp"
+
+#include <nlohmann/json.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+
+using namespace dunedaq::flxlibs;
+
+int
+main(int argc, char* argv[])
+{
+  // Usage: flxlibs_test_software_cardwrapper [seconds] [blocks per second, 0 = unthrottled]
+  int seconds = (argc > 1) ? std::stoi(argv[1]) : 5;
+  unsigned block_rate = (argc > 2) ? std::stoul(argv[2]) : 0;
+
+  nlohmann::json cmd_params = "{}"_json;
+  nlohmann::json conf_params = { { "card_backend", "software" },
+                                 { "sw_block_rate", block_rate },
+                                 { "sw_elinks", { 0, 64, 128, 192, 256 } },
+                                 { "chunk_trailer_size", 32 },
+                                 { "dma_memory_size_gb", 1 } };
+
+  TLOG() << "Creating CardWrapper with software backend...";
+  CardWrapper flx;
+
+  // Count blocks per elink and check block sequence numbers on the way
+  std::map<unsigned, size_t> elink_block_counters;
+  std::map<unsigned, unsigned> elink_next_seqnum;
+  size_t block_counter = 0;
+  size_t seqnum_errors = 0;
+  std::function<void(uint64_t)> count_block_addr = [&](uint64_t block_addr) { // NOLINT
+    block_counter++;
+    const auto* block = const_cast<felix::packetformat::block*>(
+      felix::packetformat::block_from_bytes(reinterpret_cast<const char*>(block_addr)) // NOLINT
+    );
+    unsigned elink = block->elink;
+    if (elink_next_seqnum.count(elink) != 0 && elink_next_seqnum[elink] != block->seqnum) {
+      seqnum_errors++;
+    }
+    elink_next_seqnum[elink] = (block->seqnum + 1) % 32;
+    elink_block_counters[elink]++;
+  };
+  flx.set_block_addr_handler(count_block_addr);
+
+  flx.init(cmd_params);
+  flx.configure(conf_params);
+
+  TLOG() << "Running for " << seconds << "s...";
+  auto t0 = std::chrono::steady_clock::now();
+  flx.start(cmd_params);
+  std::this_thread::sleep_for(std::chrono::seconds(seconds));
+  flx.stop(cmd_params);
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+  TLOG() << "Number of blocks DMA-d: " << block_counter << " -> " << block_counter / elapsed / 1000. << " kHz, "
+         << block_counter * 4096 / elapsed / 1e9 << " GB/s";
+  TLOG() << "Block sequence number errors: " << seqnum_errors;
+  for (const auto& [elinkid, count] : elink_block_counters) {
+    TLOG() << "  elink(" << std::to_string(elinkid) << "): " << std::to_string(count);
+  }
+
+  TLOG() << "Exiting.";
+  return (seqnum_errors == 0 && block_counter > 0) ? 0 : 1;
+}